@@ -1,9 +1,16 @@
 #include "aoc/helpers.h"
+#include "aoc/cpu.h"
+#include "aoc/parallel.h"
 
 #include <array>
+#include <bit>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace {
-  using Result = std::pair<int, int>;
+  using Result = std::pair<int64_t, int64_t>;
   using MappedFileSource = aoc::MappedFileSource<char>;
 
   constexpr std::string_view SampleInput(R"(two1nine
@@ -17,6 +24,14 @@ zoneight234
   constexpr int SR_Part1 = 209;
   constexpr int SR_Part2 = 281;
 
+  // lines with a literal zero, which is a digit like any other
+  constexpr std::array<std::pair<std::string_view, int>, 4> SR_ZeroLines{ {
+    { "0rr89itax", 9 },
+    { "9um0uxq", 90 },
+    { "0one", 1 },
+    { "two0", 20 },
+  } };
+
   const auto ProcessLine = [](std::string_view line) {
     int line_val = 0;
     while (!line.empty() && !aoc::is_numeric(line.front())) {
@@ -45,6 +60,87 @@ zoneight234
     return line_val;
   };
 
+  // Running first/last digit of the current line, fed one event at a time
+  struct DigitScan {
+    int64_t sum = 0;
+    int first = -1;
+    int last = 0;
+
+    void digit(int d) {
+      if (first < 0) {
+        first = d;
+      }
+      last = d;
+    }
+
+    void eol() {
+      if (first >= 0) {
+        sum += first * 10 + last;
+      }
+      first = -1;
+    }
+  };
+
+  void ScanDigitsScalar(const char* p, size_t n, DigitScan& st) {
+    for (size_t i = 0; i < n; i++) {
+      if (p[i] == '\n') {
+        st.eol();
+      } else if (aoc::is_numeric(p[i])) {
+        st.digit(p[i] - '0');
+      }
+    }
+  }
+
+  int64_t SumFirstLastDigitsScalar(std::string_view f) {
+    DigitScan st;
+    ScanDigitsScalar(f.data(), f.size(), st);
+    st.eol();
+    return st.sum;
+  }
+
+#if defined(__x86_64__)
+  // Classify 32 bytes at a time; only the digits and newlines in each block are
+  // visited, in order, by walking the movemask bits.
+  __attribute__((target("avx2")))
+  int64_t SumFirstLastDigitsAVX2(std::string_view f) {
+    DigitScan st;
+    const char* p = f.data();
+    const size_t n = f.size();
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+      const __m256i d = _mm256_sub_epi8(v, zero);
+      const uint32_t digits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d));
+      const uint32_t eols = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+      for (uint32_t events = digits | eols; events; events &= events - 1) {
+        const auto b = std::countr_zero(events);
+        if ((eols >> b) & 1) {
+          st.eol();
+        } else {
+          st.digit(p[i + b] - '0');
+        }
+      }
+    }
+    ScanDigitsScalar(p + i, n - i, st);
+    st.eol();
+    return st.sum;
+  }
+#endif
+
+  // Part 1 over a whole buffer
+  int64_t SumFirstLastDigits(std::string_view f) {
+#if defined(__x86_64__)
+    if (aoc::has_avx2()) {
+      return SumFirstLastDigitsAVX2(f);
+    }
+#endif
+    return SumFirstLastDigitsScalar(f);
+  }
+
   constexpr std::string_view ONE{"one"};
   constexpr std::string_view TWO{"two"};
   constexpr std::string_view THREE{"three"};
@@ -57,34 +153,176 @@ zoneight234
 
   constexpr std::array<std::string_view, 9> NUMBERS{ONE, TWO, THREE, FOUR, FIVE, SIX, SEVEN, EIGHT, NINE};
 
-  const auto PreProcessLine = [](std::string_view line) {
-    std::string out{line.data(), line.size()};
-    std::string_view out_view{out.data(), out.size()};
+  // Aho-Corasick automaton over the spelled-out numbers, built at compile time.  Only
+  // lowercase letters drive transitions, anything else resets to the root; digits are
+  // matched directly by the scanners.  Reverse builds it over the reversed words, for
+  // scanning a line from the back.
+  template<bool Reverse>
+  struct NumberAutomaton {
+    static constexpr size_t MaxStates = 64;
+    static constexpr size_t Classes = 27;
 
-    size_t i = 0;
-    while (i < out.size()) {
+    uint8_t cls[256];
+    uint8_t next[MaxStates][Classes];
+    uint8_t value[MaxStates];
+
+    constexpr NumberAutomaton()
+      : cls()
+      , next()
+      , value()
+    {
+      for (int c = 'a'; c <= 'z'; c++) {
+        cls[c] = c - 'a' + 1;
+      }
+
+      // build the trie
+      size_t states = 1;
       for (size_t j = 0; j < NUMBERS.size(); j++) {
-        const auto& num = NUMBERS[j];
-        if (aoc::starts_with(out_view, num)) {
-          out[i] = j + '1';
-          break;
+        const auto& word = NUMBERS[j];
+        size_t s = 0;
+        for (size_t k = 0; k < word.size(); k++) {
+          const auto c = cls[static_cast<uint8_t>(Reverse ? word[word.size() - k - 1] : word[k])];
+          if (!next[s][c]) {
+            next[s][c] = states++;
+          }
+          s = next[s][c];
         }
+        value[s] = j + 1;
+      }
+
+      // breadth first over the trie to fill in the failure transitions
+      uint8_t fail[MaxStates]{};
+      uint8_t queue[MaxStates]{};
+      size_t head = 0;
+      size_t tail = 0;
+      for (size_t c = 1; c < Classes; c++) {
+        if (next[0][c]) {
+          queue[tail++] = next[0][c];
+        }
+      }
+      while (head < tail) {
+        const auto s = queue[head++];
+        if (!value[s]) {
+          value[s] = value[fail[s]];
+        }
+        for (size_t c = 1; c < Classes; c++) {
+          const auto t = next[s][c];
+          if (t) {
+            fail[t] = next[fail[s]][c];
+            queue[tail++] = t;
+          } else {
+            next[s][c] = next[fail[s]][c];
+          }
+        }
+      }
+    }
+
+    // Feed one byte, returning the number it completes, or -1; '0' is a digit too
+    constexpr int step(uint8_t& s, char c) const {
+      if (aoc::is_numeric(c)) {
+        s = 0;
+        return c - '0';
       }
-      out_view.remove_prefix(1);
-      i+=1;
+      s = next[s][cls[static_cast<uint8_t>(c)]];
+      return value[s] ? value[s] : -1;
+    }
+  };
+
+  constexpr NumberAutomaton<false> FORWARD;
+  constexpr NumberAutomaton<true> BACKWARD;
+
+  const auto ProcessLineWithWords = [](std::string_view line) {
+    uint8_t s = 0;
+    int first = -1;
+    for (size_t i = 0; i < line.size() && first < 0; i++) {
+      first = FORWARD.step(s, line[i]);
+    }
+
+    if (first < 0) {
+      return 0;
+    }
+
+    s = 0;
+    int last = -1;
+    for (size_t j = line.size(); j > 0 && last < 0; j--) {
+      last = BACKWARD.step(s, line[j - 1]);
     }
 
-    DEBUG_PRINT("input: " << line << " output: " << out);
+    DEBUG_PRINT("line: " << line << " output: " << first * 10 + last);
 
-    return out;
+    return first * 10 + last;
   };
 
   const auto LoadInput = [](auto f) {
     Result r{0, 0};
+    r.first = SumFirstLastDigits(f);
     std::string_view line;
     while (aoc::getline(f, line)) {
-      r.first += ProcessLine(line);
-      r.second += ProcessLine(PreProcessLine(line));
+      r.second += ProcessLineWithWords(line);
+    }
+    return r;
+  };
+
+  // Time the vectorised part 1 against the line-at-a-time ProcessLine on `mb'
+  // megabytes made by repeating the input
+  const auto Benchmark = [](std::string_view f, size_t mb) {
+    std::string big;
+    big.reserve(mb << 20);
+    while (big.size() < (mb << 20)) {
+      big.append(f);
+      if (big.back() != '\n') {
+        big.push_back('\n');
+      }
+    }
+    std::string_view b(big);
+
+    int64_t lines = 0;
+    {
+      aoc::AutoTimer t{"ProcessLine"};
+      std::string_view bb(b);
+      std::string_view line;
+      while (aoc::getline(bb, line)) {
+        lines += ProcessLine(line);
+      }
+    }
+    int64_t scalar = 0;
+    {
+      aoc::AutoTimer t{"Scalar"};
+      scalar = SumFirstLastDigitsScalar(b);
+    }
+    int64_t vectorised = 0;
+    {
+      aoc::AutoTimer t{"SumFirstLastDigits"};
+      vectorised = SumFirstLastDigits(b);
+    }
+    aoc::assert_result(scalar, lines);
+    aoc::assert_result(vectorised, lines);
+  };
+
+  // Cut the input into one newline-aligned chunk per thread and sum each on its own
+  const auto LoadInputParallel = [](std::string_view f, size_t threads) {
+    std::vector<std::string_view> chunks;
+    const size_t chunk_size = f.size() / std::max<size_t>(threads, 1) + 1;
+    while (!f.empty()) {
+      size_t end = std::min(f.size(), chunk_size);
+      while (end < f.size() && f[end - 1] != '\n') {
+        end++;
+      }
+      chunks.push_back(f.substr(0, end));
+      f.remove_prefix(end);
+    }
+
+    std::vector<Result> results(chunks.size());
+    aoc::parallel_for(chunks.size(), chunks.size(), [&chunks, &results](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        results[i] = LoadInput(chunks[i]);
+      }
+    });
+
+    Result r{0, 0};
+    for (const auto& c : results) {
+      r.first += c.first;
+      r.second += c.second;
     }
     return r;
   };
@@ -94,17 +332,24 @@ int main(int argc, char** argv) {
   aoc::AutoTimer t;
   const bool inTest = argc < 2;
 
+  const auto threads = aoc::get_int_option(argc, argv, "--threads", 1);
+
   Result r;
   if (inTest) {
     r = LoadInput(SampleInput);
   } else {
     std::unique_ptr<MappedFileSource>m(new MappedFileSource(argc, argv));
     std::string_view f(m->data(), m->size());
-    r = LoadInput(f);
+    r = threads > 1 ? LoadInputParallel(f, threads) : LoadInput(f);
+
+    const auto bench_mb = aoc::get_int_option(argc, argv, "--bench", 0);
+    if (bench_mb > 0) {
+      Benchmark(f, bench_mb);
+    }
   }
 
-  int part1 = 0;
-  int part2 = 0;
+  int64_t part1 = 0;
+  int64_t part2 = 0;
 
   std::tie(part1, part2) = r;
 
@@ -113,6 +358,19 @@ int main(int argc, char** argv) {
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+    aoc::assert_result(LoadInputParallel(SampleInput, 3), r);
+
+    int64_t lines = 0;
+    std::string_view f(SampleInput);
+    std::string_view line;
+    while (aoc::getline(f, line)) {
+      lines += ProcessLine(line);
+    }
+    aoc::assert_result(SumFirstLastDigitsScalar(SampleInput), lines);
+
+    for (const auto& [line, e] : SR_ZeroLines) {
+      aoc::assert_result(ProcessLineWithWords(line), e);
+    }
   }
 
   return 0;
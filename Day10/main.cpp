@@ -1,5 +1,6 @@
 #include "aoc/helpers.h"
 
+#include <array>
 #include <vector>
 
 namespace {
@@ -20,6 +21,10 @@ L7JLJL-JLJLJL--JLJ.L
   constexpr size_t SR_Part1 = 80;
   constexpr size_t SR_Part2 = 10;
 
+  // pipes which lead off the top and the bottom of the map
+  constexpr std::array<std::string_view, 2> SR_BrokenInputs{ ".|.\n.S.\n", ".S.\n.|." };
+  constexpr std::string_view SR_BrokenError("Broken pipe");
+
   enum Direction
   {
     None = 0,
@@ -29,65 +34,108 @@ L7JLJL-JLJLJL--JLJ.L
     Right = 8,
   };
 
-  const auto GetDirection = [](char c) {
-    switch (c) {
-      case '|': return Direction::Up | Direction::Down;
-      case '-': return Direction::Left | Direction::Right;
-      case 'L': return Direction::Up | Direction::Right;
-      case 'J': return Direction::Up | Direction::Left;
-      case 'F': return Direction::Down | Direction::Right;
-      case '7': return Direction::Down | Direction::Left;
-      case '.': return static_cast<int>(Direction::None);
-      case '#': return static_cast<int>(Direction::None);
-      case 'S': return Direction::Up | Direction::Down | Direction::Left | Direction::Right;
-    }
-    throw std::runtime_error("Unknown direction");
+  constexpr uint8_t Opposite(uint8_t d) {
+    return (d & (Direction::Up | Direction::Down)) ? d ^ (Direction::Up | Direction::Down) : d ^ (Direction::Left | Direction::Right);
+  }
+
+  // The directions each byte connects to
+  struct PipeTable {
+    uint8_t dirs[256];
+
+    constexpr PipeTable()
+      : dirs() {
+        dirs[static_cast<uint8_t>('|')] = Direction::Up | Direction::Down;
+        dirs[static_cast<uint8_t>('-')] = Direction::Left | Direction::Right;
+        dirs[static_cast<uint8_t>('L')] = Direction::Up | Direction::Right;
+        dirs[static_cast<uint8_t>('J')] = Direction::Up | Direction::Left;
+        dirs[static_cast<uint8_t>('F')] = Direction::Down | Direction::Right;
+        dirs[static_cast<uint8_t>('7')] = Direction::Down | Direction::Left;
+        dirs[static_cast<uint8_t>('S')] = Direction::Up | Direction::Down | Direction::Left | Direction::Right;
+      }
   };
 
-  using Path = std::vector<aoc::Point>;
+  constexpr PipeTable PIPES;
 
-  const auto LoadInput = [](auto f) {
-    std::string_view line;
+  // Trace the loop directly over the input bytes, addressing cells by row stride.
+  // Each pipe has exactly two ends, so the way on is whichever end we did not come in
+  // by.  Returns the loop length and twice its signed (shoelace) area.
+  const auto TraceLoop = [](std::string_view f) -> std::pair<int64_t, int64_t> {
+    const auto width = static_cast<int64_t>(std::min(f.find_first_of(aoc::eol_delims), f.size()));
+    int64_t stride = width;
+    while (stride < static_cast<int64_t>(f.size()) && (f[stride] == '\r' || f[stride] == '\n')) {
+      stride++;
+    }
+    // the last row may not have a line ending
+    const auto height = (static_cast<int64_t>(f.size()) + stride - width) / stride;
 
-    aoc::Point p{ -1, -1 };
-    std::vector<std::string> data;
-    while (aoc::getline(f, line)) {
-      if (p.first == -1) {
-        const auto i = line.find('S');
-        if (i != std::string::npos) {
-          p.first = i;
-          p.second = data.size();
+    const auto start = f.find('S');
+    if (start == std::string_view::npos) {
+      throw std::runtime_error("No start");
+    }
+    int64_t x = start % stride;
+    int64_t y = start / stride;
+    DEBUG_PRINT("Found Start at " << aoc::Point(x, y));
 
-          DEBUG_PRINT("Found Start at " << p);
-        }
+    const auto dirs_at = [&f, stride, width, height](int64_t x, int64_t y) -> uint8_t {
+      if (x < 0 || x >= width || y < 0 || y >= height) {
+        return Direction::None;
       }
-      data.emplace_back(line.data(), line.size());
+      return PIPES.dirs[static_cast<uint8_t>(f[y * stride + x])];
+    };
+    const auto step = [](uint8_t d, int64_t& x, int64_t& y) {
+      x += (d == Direction::Right) - (d == Direction::Left);
+      y += (d == Direction::Down) - (d == Direction::Up);
+    };
+
+    // leave the start by the first neighbour which connects back to it
+    uint8_t d = Direction::None;
+    for (const uint8_t c : { Direction::Right, Direction::Down, Direction::Left, Direction::Up }) {
+      int64_t nx = x;
+      int64_t ny = y;
+      step(c, nx, ny);
+      if (dirs_at(nx, ny) & Opposite(c)) {
+        d = c;
+        break;
+      }
+    }
+    if (d == Direction::None) {
+      throw std::runtime_error("Start is not connected");
     }
 
-    aoc::Point limit{ data[0].size() - 1, data.size() - 1 };
-
-    Path path;
-    while (1) {
-      path.push_back(p);
-      auto& c = data[p.second][p.first];
-      auto d = GetDirection(c);
-      // the pipes must be connected, find one to move to
-      if (p.first < limit.first && (d & Direction::Right) && GetDirection(data[p.second][p.first + 1]) & Direction::Left) {
-        p.first++;
-      } else if (p.second < limit.second && (d & Direction::Down) && GetDirection(data[p.second + 1][p.first]) & Direction::Up) {
-        p.second++;
-      } else if (p.first > 0 && (d & Direction::Left) && GetDirection(data[p.second][p.first - 1]) & Direction::Right) {
-        p.first--;
-      } else if (p.second > 0 && (d & Direction::Up) && GetDirection(data[p.second - 1][p.first]) & Direction::Down) {
-        p.second--;
-      } else {
+    std::vector<uint64_t> visited((width * height + 63) / 64, 0);
+    int64_t length = 0;
+    int64_t area = 0;
+    while (true) {
+      const auto cell = y * width + x;
+      if (visited[cell >> 6] & (uint64_t{1} << (cell & 63))) {
+        throw std::runtime_error("Loop crosses itself");
+      }
+      visited[cell >> 6] |= uint64_t{1} << (cell & 63);
+
+      int64_t nx = x;
+      int64_t ny = y;
+      step(d, nx, ny);
+      area += x * ny - y * nx;
+      length++;
+      x = nx;
+      y = ny;
+
+      // off the map reads as no pipe, so it is caught here before it is read
+      const auto here = dirs_at(x, y);
+      if (!(here & Opposite(d))) {
+        throw std::runtime_error("Broken pipe");
+      }
+      if (f[y * stride + x] == 'S') {
         break;
       }
-      c = '#';
-      DEBUG_PRINT("Moved to " << p);
+      const auto next = here & ~Opposite(d);
+      if (next & (next - 1)) {
+        throw std::runtime_error("Broken pipe");
+      }
+      d = next;
     }
 
-    return path;
+    return { length, area };
   };
 }
 
@@ -95,41 +143,35 @@ int main(int argc, char** argv) {
   aoc::AutoTimer t;
   const bool inTest = argc < 2;
 
-  Path path;
+  std::pair<int64_t, int64_t> loop;
   if (inTest) {
-    path = LoadInput(SampleInput);
+    loop = TraceLoop(SampleInput);
   } else {
     std::unique_ptr<MappedFileSource>m(new MappedFileSource(argc, argv));
     std::string_view f(m->data(), m->size());
-    path = LoadInput(f);
+    loop = TraceLoop(f);
   }
 
-  const auto part1{path.size() / 2};
-  size_t part2{};
-
-  path.push_back(path.front());
-
-  // calculate the area of the enclosed path.
-  size_t pos{};
-  size_t next{1};
-  int64_t area{};
-  while (next < path.size()) {
-    auto& a = path[pos];
-    auto& b = path[next];
-    area += a.first * b.second - a.second * b.first;
-
-    pos++;
-    next++;
-  }
-  // subtract the circumference (which is path.size() - 1, as we pushed the start to close the loop)
-  area = (std::abs(area) - (path.size() - 1)) / 2;
-  part2 = area + 1;
+  const auto [length, area] = loop;
+  const size_t part1 = length / 2;
+  // Pick's theorem, interior points from the area less the boundary
+  const size_t part2 = (std::abs(area) - length) / 2 + 1;
 
   aoc::print_results(part1, part2);
 
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+
+    for (const auto broken : SR_BrokenInputs) {
+      std::string error;
+      try {
+        TraceLoop(broken);
+      } catch (const std::runtime_error& e) {
+        error = e.what();
+      }
+      aoc::assert_result(error, SR_BrokenError);
+    }
   }
 
   return 0;
@@ -1,6 +1,7 @@
 #include "aoc/helpers.h"
 
-#include <set>
+#include <array>
+#include <span>
 #include <vector>
 
 namespace {
@@ -17,65 +18,80 @@ namespace {
 .......#..
 #...#.....)");
   constexpr int SR_Part1 = 374;
-  constexpr int SR_Part2 = 0;
+  constexpr int SR_Part2 = 82000210;
 
-  using Points = std::vector<aoc::Point>;
-  using EmptyList = std::vector<int64_t>;
+  // distances for the examples' other expansion factors
+  constexpr std::array<std::pair<int64_t, int64_t>, 4> SR_Factors{ { { 2, 374 }, { 10, 1030 }, { 100, 8410 }, { 1000000, 82000210 } } };
 
+  // Galaxies per row and per column; a zero count marks an empty line.  Both are
+  // filled in the one pass over the input.
   struct Input {
-    Points points;
-    EmptyList empty_rows;
-    EmptyList empty_cols;
+    std::vector<int64_t> row_counts;
+    std::vector<int64_t> col_counts;
   };
 
   const auto LoadInput = [](auto f) {
     std::string_view line;
-    int64_t y = 0;
     Input r;
-    std::set<int64_t> x_points;
-    std::vector<std::string_view> universe;
     while (aoc::getline(f, line)) {
-      universe.push_back(line);
-      bool empty = true;
-      const int64_t w = line.size();
-      for (int64_t x = 0; x < w; ++x) {
-        if (line[x] == '#') {
-          r.points.emplace_back(x, y);
-          empty = false;
-          x_points.emplace(x);
-        }
+      int64_t count = 0;
+      if (r.col_counts.size() < line.size()) {
+        r.col_counts.resize(line.size(), 0);
       }
-      if (empty) {
-        r.empty_rows.push_back(y);
-        DEBUG_PRINT("Empty row " << y);
+      for (size_t x = 0; x < line.size(); ++x) {
+        const int64_t galaxy = line[x] == '#';
+        r.col_counts[x] += galaxy;
+        count += galaxy;
       }
-      y++;
+      DEBUG(if (!count) { DEBUG_PRINT("Empty row " << r.row_counts.size()); });
+      r.row_counts.push_back(count);
     }
+    return r;
+  };
 
-    for (size_t i = 0; i < universe[0].size(); ++i) {
-      bool empty = !std::any_of(universe.begin(), universe.end(), [i, &x_points](auto s) {
-        return s[i] == '#';
-      });
-      if (empty) {
-        r.empty_cols.push_back(i);
-        DEBUG_PRINT("Empty col " << i);
-      }
+  // Sum over all pairs of galaxies of the gap between them along one axis, split into
+  // the unexpanded gap and the number of empty lines crossed, so that the expanded
+  // total for any factor is base + (factor - 1) * crossed.  Walking the counts in
+  // order visits the galaxies sorted, where the i-th of n contributes its coordinate
+  // with weight 2i - (n - 1).
+  struct AxisSums {
+    int64_t base{0};
+    int64_t crossed{0};
+  };
+
+  AxisSums SumAxis(const std::vector<int64_t>& counts) {
+    int64_t n = 0;
+    for (const auto k : counts) {
+      n += k;
     }
 
+    AxisSums r;
+    int64_t i = 0;
+    int64_t empties = 0;
+    for (size_t c = 0; c < counts.size(); c++) {
+      const auto k = counts[c];
+      if (!k) {
+        empties++;
+        continue;
+      }
+      // the weights of galaxies i to i + k - 1
+      const auto w = k * (2 * i - (n - 1)) + k * (k - 1);
+      r.base += static_cast<int64_t>(c) * w;
+      r.crossed += empties * w;
+      i += k;
+    }
     return r;
-  };
-
-  const auto get_cosmic_expansion = [](int64_t a, int64_t b, const EmptyList& expanded, const int64_t expansion_factor) -> int64_t {
-    const auto l = std::min(a, b);
-    const auto r = std::max(a, b);
+  }
 
-    int64_t distance = 0;
-    auto idx = std::lower_bound(expanded.begin(), expanded.end(), l);
-    while (idx != expanded.end() && *idx < r) {
-      distance += expansion_factor - 1;
-      ++idx;
+  // Total pairwise distance for each expansion factor, from one pass over each axis
+  const auto SumDistances = [](const Input& r, std::span<const int64_t> factors) {
+    const auto rows = SumAxis(r.row_counts);
+    const auto cols = SumAxis(r.col_counts);
+    std::vector<int64_t> out;
+    for (const auto f : factors) {
+      out.push_back(rows.base + cols.base + (f - 1) * (rows.crossed + cols.crossed));
     }
-    return distance;
+    return out;
   };
 }
 
@@ -92,40 +108,14 @@ int main(int argc, char** argv) {
     r = LoadInput(f);
   }
 
-
-  const auto pair_wise_cosmic_distance = [&r](const aoc::Point& p1, const aoc::Point& p2, int64_t expansion_factor) {
-    const auto x_exp = get_cosmic_expansion(p1.first, p2.first, r.empty_cols, expansion_factor);
-    const auto y_exp = get_cosmic_expansion(p1.second, p2.second, r.empty_rows, expansion_factor);
-    const auto dist = aoc::manhattan(p1, p2);
-    return dist + x_exp + y_exp;
-  };
-
   int64_t part1 = 0;
-  {
-    aoc::AutoTimer t1{"Part 1"};
-    for (size_t it = 0; it < r.points.size() - 1; ++it) {
-      const auto& p = r.points[it];
-      for (size_t next = it + 1; next < r.points.size(); ++next) {
-        const auto& n = r.points[next];
-        const auto dist = pair_wise_cosmic_distance(p, n, 2);
-        DEBUG_PRINT("Distance from [" << (it + 1) << "] " << p << " to [" << (next + 1) << "] " << n << " = " << dist);
-        part1 += dist;
-      }
-    }
-  }
-
   int64_t part2 = 0;
   {
-    aoc::AutoTimer t2{"Part 2"};
-    for (size_t it = 0; it < r.points.size() - 1; ++it) {
-      const auto& p = r.points[it];
-      for (size_t next = it + 1; next < r.points.size(); ++next) {
-        const auto& n = r.points[next];
-        const auto dist = pair_wise_cosmic_distance(p, n, 1000000);
-        DEBUG_PRINT("Distance from [" << (it + 1) << "] " << p << " to [" << (next + 1) << "] " << n << " = " << dist);
-        part2 += dist;
-      }
-    }
+    aoc::AutoTimer t1{"Parts 1 and 2"};
+    const std::array<int64_t, 2> factors{ 2, 1000000 };
+    const auto d = SumDistances(r, factors);
+    part1 = d[0];
+    part2 = d[1];
   }
 
   aoc::print_results(part1, part2);
@@ -133,6 +123,15 @@ int main(int argc, char** argv) {
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+
+    std::vector<int64_t> factors;
+    for (const auto& [f, e] : SR_Factors) {
+      factors.push_back(f);
+    }
+    const auto d = SumDistances(r, factors);
+    for (size_t i = 0; i < d.size(); i++) {
+      aoc::assert_result(d[i], SR_Factors[i].second);
+    }
   }
 
   return 0;
@@ -1,10 +1,23 @@
 #include "aoc/helpers.h"
+#include "aoc/parallel.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <deque>
+#include <exception>
+#include <mutex>
 #include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
 
 namespace {
-  using Result = std::pair<int64_t, int64_t >;
+  // unfolded records have far more arrangements than fit in 64 bits
+  using Count = __int128;
+  using Result = std::pair<Count, Count>;
   using MappedFileSource = aoc::MappedFileSource<char>;
 
   constexpr std::string_view SampleInput(R"(???.### 1,1,3
@@ -16,48 +29,88 @@ namespace {
   constexpr int64_t SR_Part1 = 21;
   constexpr int64_t SR_Part2 = 525152;
 
-  using SpringConfig = std::pair<std::string_view, std::vector<int64_t>>;
+  // The records, with the groups of every record packed into one array; record i's
+  // groups are groups[group_offsets[i], group_offsets[i + 1])
+  struct Records {
+    std::vector<std::string_view> patterns;
+    std::vector<int64_t> groups;
+    std::vector<size_t> group_offsets{ 0 };
 
-  const auto GetGroupEnds = [](int64_t hashes, const std::vector<int64_t>& groups) {
-    std::vector<bool> group_ends(hashes + 1);
-    group_ends[0] = true;
-
-    int64_t group_end = 0;
-    for (const auto& g : groups) {
-      group_end += g;
-      group_ends[group_end] = true;
+    size_t size() const { return patterns.size(); }
+    std::span<const int64_t> GroupsOf(size_t i) const {
+      return { groups.data() + group_offsets[i], groups.data() + group_offsets[i + 1] };
     }
+  };
 
-    return group_ends;
+  // Scratch space for CountPermutations, one per thread and kept between records
+  // so the DP does no allocation once it has grown to the largest record seen
+  struct PermutationScratch {
+    std::vector<uint8_t> group_ends;
+    std::vector<std::array<Count, 2>> rows[2];
+    std::string unfolded;
+    std::vector<int64_t> unfolded_groups;
+    // for MemoCounter
+    std::vector<uint64_t> pattern_hashes;
+    std::vector<uint32_t> runs;
+    std::vector<uint64_t> group_hashes;
+    std::vector<size_t> needed;
+    std::vector<Count> known;
   };
 
-  const auto CountPermutations = [](const SpringConfig& s) {
-    const size_t total_hashes = std::accumulate(s.second.begin(), s.second.end(), 0);
+  // Counts grow exponentially with the unfold, so refuse to wrap silently
+  Count AddCounts(Count a, Count b) {
+    Count r;
+    if (__builtin_add_overflow(a, b, &r)) {
+      throw std::overflow_error("Arrangement count does not fit in 128 bits");
+    }
+    return r;
+  }
+
+  PermutationScratch& Scratch() {
+    thread_local PermutationScratch scratch;
+    return scratch;
+  }
+
+  const auto CountPermutations = [](std::string_view pattern, std::span<const int64_t> groups) {
+    auto& scratch = Scratch();
+
+    const size_t total_hashes = std::accumulate(groups.begin(), groups.end(), size_t{0});
+
+    // group_ends[n] is set if n placed hashes completes a group
+    auto& group_ends = scratch.group_ends;
+    group_ends.assign(total_hashes + 1, 0);
+    group_ends[0] = 1;
+    size_t group_end = 0;
+    for (const auto& g : groups) {
+      group_end += g;
+      group_ends[group_end] = 1;
+    }
 
-    const auto group_ends = GetGroupEnds(total_hashes, s.second);
-    constexpr int64_t max_hashes = 100;
     enum {
       DOT = 0,
       HASH = 1,
     };
-    auto cache = new int64_t[s.first.size() + 1][max_hashes][2];
-    for (size_t i = 0; i < s.first.size() + 1; ++i) {
-      for (size_t j = 0; j < max_hashes; ++j) {
-        cache[i][j][DOT] = 0;
-        cache[i][j][HASH] = 0;
+    // row[placed][last] counts the ways to fill the pattern so far with `placed`
+    // hashes, ending in a dot or a hash.  Only two rows are live at once.
+    for (auto& row : scratch.rows) {
+      if (row.size() < total_hashes + 1) {
+        row.resize(total_hashes + 1);
       }
     }
-    cache[0][0][DOT] = 1;
+    auto* prev = scratch.rows[0].data();
+    auto* current = scratch.rows[1].data();
+    prev[0] = { 1, 0 };
 
-    for (size_t i = 1; i <= s.first.size(); ++i) {
-      const auto c = s.first[i - 1];
-
-      auto& current = cache[i];
-      auto& prev = cache[i - 1];
+    for (size_t i = 1; i <= pattern.size(); ++i) {
+      const auto c = pattern[i - 1];
+      // no more than i hashes fit in the first i springs, so nothing past the band
+      // is ever read
+      const size_t band = std::min(i, total_hashes);
+      std::fill(current, current + band + 1, std::array<Count, 2>{ 0, 0 });
 
       if (c != '.') {
         // Could be a hash
-        for (size_t placed = 1; placed <= std::min(i, total_hashes); placed++) {
+        for (size_t placed = 1; placed <= band; placed++) {
           if (group_ends[placed - 1]) {
             // if a new group, must follow a hash
             current[placed][HASH] = prev[placed - 1][DOT];
@@ -72,43 +125,330 @@ namespace {
         for (size_t placed = 0; placed <= std::min(i - 1, total_hashes); placed++) {
           if (group_ends[placed]) {
             // if end of a group, we must place a dot
-            current[placed][DOT] = prev[placed][HASH] + prev[placed][DOT];
+            current[placed][DOT] = AddCounts(prev[placed][HASH], prev[placed][DOT]);
           }
         }
       }
+      std::swap(prev, current);
     }
 
-    // number of possibilities is the sum of the lats element
-    const int64_t r = cache[s.first.size()][total_hashes][DOT] + cache[s.first.size()][total_hashes][HASH];
-    delete [] cache;
-    return r;
+    // number of possibilities is the sum of the last row's complete states
+    if (total_hashes > pattern.size()) {
+      return Count{0};
+    }
+    return AddCounts(prev[total_hashes][DOT], prev[total_hashes][HASH]);
+  };
+
+  // Arrangement counts shared by every record, keyed on the content of the pattern
+  // suffix left to fill and the groups left to place in it, so a tail seen in one
+  // record is never counted again in another.  Threads publish their new entries a
+  // record at a time, so the shared table, sharded by key, is locked once per
+  // lookup and once per record.
+  class SuffixCache {
+  public:
+    // A sub-problem; the hash is only for bucketing, keys match on the contents
+    struct Key {
+      size_t hash;
+      std::string_view pattern;
+      std::span<const int64_t> groups;
+
+      bool operator==(const Key& o) const {
+        return hash == o.hash && pattern == o.pattern
+          && std::equal(groups.begin(), groups.end(), o.groups.begin(), o.groups.end());
+      }
+    };
+
+  private:
+    struct KeyHash {
+      size_t operator()(const Key& k) const { return k.hash; }
+    };
+    using Table = std::unordered_map<Key, Count, KeyHash>;
+
+    struct Shard {
+      std::mutex lock;
+      Table counts;
+
+      // growing from empty costs as much as the lookups themselves
+      Shard() {
+        counts.reserve(4096);
+      }
+    };
+    static constexpr size_t ShardCount = 64;
+
+    Shard& ShardOf(size_t hash) {
+      return shards[(hash >> 32) % ShardCount];
+    }
+
+    std::optional<Count> Find(const Key& k) {
+      auto& shard = ShardOf(k.hash);
+      std::lock_guard<std::mutex> lock(shard.lock);
+      const auto it = shard.counts.find(k);
+      if (it == shard.counts.end()) {
+        return std::nullopt;
+      }
+      return it->second;
+    }
+
+    // Copies of the records which keys point into; a deque never moves its elements
+    std::mutex records_lock;
+    std::deque<std::string> patterns;
+    std::deque<std::vector<int64_t>> groups;
+
+    std::array<Shard, ShardCount> shards;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+
+  public:
+    // Copy a record the keys for its sub-problems can point into
+    std::pair<std::string_view, std::span<const int64_t>> Own(std::string_view pattern, std::span<const int64_t> g) {
+      std::lock_guard<std::mutex> lock(records_lock);
+      const auto& p = patterns.emplace_back(pattern);
+      const auto& v = groups.emplace_back(g.begin(), g.end());
+      return { p, v };
+    }
+
+    // One thread's use of the cache, holding back its new entries until the record
+    // that made them is done
+    class Local {
+      SuffixCache& shared;
+      std::vector<std::pair<Key, Count>> pending;
+      uint64_t hits = 0;
+      uint64_t misses = 0;
+
+    public:
+      explicit Local(SuffixCache& shared)
+        : shared(shared)
+      { }
+
+      ~Local() {
+        Publish();
+        shared.hits += hits;
+        shared.misses += misses;
+      }
+
+      SuffixCache& Shared() {
+        return shared;
+      }
+
+      // a repeat found, or a count made, without asking the shared table
+      void Hit() {
+        hits++;
+      }
+
+      void Miss() {
+        misses++;
+      }
+
+      std::optional<Count> Find(const Key& k) {
+        const auto c = shared.Find(k);
+        c ? hits++ : misses++;
+        return c;
+      }
+
+      // k must point into a record from Own
+      void Insert(const Key& k, Count c) {
+        pending.emplace_back(k, c);
+      }
+
+      void Publish() {
+        for (const auto& [k, c] : pending) {
+          auto& shard = shared.ShardOf(k.hash);
+          std::lock_guard<std::mutex> lock(shard.lock);
+          shard.counts.emplace(k, c);
+        }
+        pending.clear();
+      }
+    };
+
+    uint64_t Hits() const { return hits; }
+    uint64_t Misses() const { return misses; }
+  };
+
+  // Counts arrangements top-down, placing one group at a time.  Each (pattern suffix,
+  // group suffix) sub-problem is remembered for the rest of the record in a dense
+  // table.  Suffixes starting a run of springs, the ones other records are likely to
+  // end with, are also shared through the SuffixCache, bucketed by polynomial hashes
+  // taken from the end of the record.
+  class MemoCounter {
+    static constexpr uint64_t PatternBase = 0x100000001b3ull;
+    static constexpr uint64_t GroupBase = 0xff51afd7ed558ccdull;
+
+    SuffixCache::Local& cache;
+    std::string_view pattern;
+    std::span<const int64_t> groups;
+    // hash of pattern[i..], length of the run of non-dots from i, hash of groups[j..],
+    // and the fewest springs that can hold groups[j..]
+    std::vector<uint64_t>& pattern_hashes;
+    std::vector<uint32_t>& runs;
+    std::vector<uint64_t>& group_hashes;
+    std::vector<size_t>& needed;
+    // counts by i * (groups + 1) + j, or -1 if not yet known
+    std::vector<Count>& known;
+    size_t last_hash;
+
+    Count CountFrom(size_t i, size_t j) {
+      while (i < pattern.size() && pattern[i] == '.') {
+        i++;
+      }
+      if (j == groups.size()) {
+        // the rest must all be dots
+        return last_hash == std::string_view::npos || i > last_hash;
+      }
+      if (pattern.size() - i < needed[j]) {
+        return 0;
+      }
+
+      auto& memo = known[i * (groups.size() + 1) + j];
+      if (memo >= 0) {
+        cache.Hit();
+        return memo;
+      }
+      const bool shared = i == 0 || pattern[i - 1] == '.';
+      const SuffixCache::Key key{ pattern_hashes[i] ^ (group_hashes[j] * 0x9e3779b97f4a7c15ull),
+        pattern.substr(i), groups.subspan(j) };
+      if (!shared) {
+        cache.Miss();
+      } else if (const auto c = cache.Find(key)) {
+        memo = *c;
+        return *c;
+      }
+
+      Count r = 0;
+      // place group j here, if it fits and is not followed by a hash
+      const size_t g = groups[j];
+      if (runs[i] >= g && (i + g == pattern.size() || pattern[i + g] != '#')) {
+        r = CountFrom(std::min(i + g + 1, pattern.size()), j + 1);
+      }
+      // or leave this spring as a dot
+      if (pattern[i] == '?') {
+        r = AddCounts(r, CountFrom(i + 1, j));
+      }
+
+      // the recursion does not resize known, so memo is still valid
+      memo = r;
+      if (shared) {
+        cache.Insert(key, r);
+      }
+      return r;
+    }
+
+  public:
+    // the record is copied into the cache up front, so the keys can point into it
+    MemoCounter(SuffixCache::Local& cache, std::string_view record, std::span<const int64_t> record_groups)
+      : cache(cache)
+      , pattern()
+      , groups()
+      , pattern_hashes(Scratch().pattern_hashes)
+      , runs(Scratch().runs)
+      , group_hashes(Scratch().group_hashes)
+      , needed(Scratch().needed)
+      , known(Scratch().known)
+      , last_hash(record.find_last_of('#'))
+    {
+      std::tie(pattern, groups) = cache.Shared().Own(record, record_groups);
+      const auto n = pattern.size();
+      pattern_hashes.resize(n + 1);
+      runs.resize(n + 1);
+      pattern_hashes[n] = 0;
+      runs[n] = 0;
+      for (size_t i = n; i-- > 0; ) {
+        pattern_hashes[i] = pattern_hashes[i + 1] * PatternBase + static_cast<uint8_t>(pattern[i]);
+        runs[i] = pattern[i] == '.' ? 0 : runs[i + 1] + 1;
+      }
+
+      const auto m = groups.size();
+      group_hashes.resize(m + 1);
+      needed.resize(m + 1);
+      group_hashes[m] = 0;
+      needed[m] = 0;
+      for (size_t j = m; j-- > 0; ) {
+        group_hashes[j] = (group_hashes[j + 1] + static_cast<uint64_t>(groups[j])) * GroupBase;
+        needed[j] = needed[j + 1] + groups[j] + (j + 1 < m);
+      }
+    }
+
+    Count Total() {
+      known.assign((pattern.size() + 1) * (groups.size() + 1), -1);
+      const auto r = CountFrom(0, 0);
+      cache.Publish();
+      return r;
+    }
+  };
+
+  // Count with the cache when there is one, else with the rolling DP
+  const auto CountArrangements = [](std::string_view pattern, std::span<const int64_t> groups, SuffixCache::Local* cache) {
+    if (cache) {
+      return MemoCounter(*cache, pattern, groups).Total();
+    }
+    return CountPermutations(pattern, groups);
   };
 
   const auto LoadInput = [](auto f) {
-    Result r;
+    Records r;
     std::string_view line;
     while (aoc::getline(f, line)) {
-      SpringConfig s;
       const auto it = line.find(' ');
-      s.first = line.substr(0, it);
+      r.patterns.push_back(line.substr(0, it));
       const auto rest = line.substr(it + 1);
-      aoc::parse_as_integers(rest, ',', [&s](const auto n) { s.second.push_back(n); } );
+      aoc::parse_as_integers(rest, ',', [&r](const auto n) { r.groups.push_back(n); } );
+      r.group_offsets.push_back(r.groups.size());
+    }
+    return r;
+  };
 
-      r.first += CountPermutations(s);
+  // Count the arrangements of a record repeated `unfold` times, joined by '?'
+  const auto CountUnfolded = [](std::string_view pattern, std::span<const int64_t> groups, int64_t unfold, SuffixCache::Local* cache) {
+    if (unfold == 1) {
+      return CountArrangements(pattern, groups, cache);
+    }
+    auto& scratch = Scratch();
+    auto& unfolded = scratch.unfolded;
+    auto& unfolded_groups = scratch.unfolded_groups;
+    unfolded.assign(pattern.data(), pattern.size());
+    unfolded_groups.assign(groups.begin(), groups.end());
+    for (int64_t i = 1; i < unfold; i++) {
+      unfolded.append(1, '?')
+        .append(pattern.data(), pattern.size());
+      unfolded_groups.insert(unfolded_groups.end(), groups.begin(), groups.end());
+    }
+    // the counters do not touch the unfolded buffers, so they may borrow them
+    return CountArrangements(unfolded, unfolded_groups, cache);
+  };
 
-      // unfolod the input
-      std::string unfolded{s.first.data(), s.first.size()};
-      SpringConfig s2;
-      s2.second = s.second;
-      for (auto i = 0; i < 4; i++) {
-        unfolded.append(1, '?')
-          .append(s.first.data(), s.first.size());
-        s2.second.insert(s2.second.end(), s.second.begin(), s.second.end());
+  // Sum the folded and unfolded counts over all records, with contiguous runs of
+  // records handed to each thread.  With a cache, every thread shares it.
+  const auto SolveRecords = [](const Records& r, int64_t unfold, size_t threads, SuffixCache* cache = nullptr) {
+    Result total;
+    std::exception_ptr error;
+    std::mutex total_lock;
+    aoc::parallel_for(r.size(), threads, [&r, &total, &error, &total_lock, unfold, cache](size_t begin, size_t end) {
+      // an exception must not escape a worker thread, so hand it back to the caller
+      try {
+        std::optional<SuffixCache::Local> local;
+        if (cache) {
+          local.emplace(*cache);
+        }
+        SuffixCache::Local* const l = local ? &*local : nullptr;
+        Result sum;
+        for (size_t i = begin; i < end; i++) {
+          const auto groups = r.GroupsOf(i);
+          sum.first = AddCounts(sum.first, CountArrangements(r.patterns[i], groups, l));
+          sum.second = AddCounts(sum.second, CountUnfolded(r.patterns[i], groups, unfold, l));
+        }
+        std::lock_guard<std::mutex> lock(total_lock);
+        total.first = AddCounts(total.first, sum.first);
+        total.second = AddCounts(total.second, sum.second);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(total_lock);
+        if (!error) {
+          error = std::current_exception();
+        }
       }
-      s2.first = { unfolded.data(), unfolded.size() };
-      r.second += CountPermutations(s2);
+    });
+    if (error) {
+      std::rethrow_exception(error);
     }
-    return r;
+    return total;
   };
 }
 
@@ -116,25 +456,70 @@ int main(int argc, char** argv) {
   aoc::AutoTimer t;
   const bool inTest = argc < 2;
 
-  Result r;
+  const auto unfold = aoc::get_int_option(argc, argv, "--unfold", 5);
+  const size_t threads = aoc::get_int_option(argc, argv, "--threads", aoc::default_thread_count());
+  if (unfold < 1) {
+    throw std::invalid_argument("--unfold must be at least 1");
+  }
+
+  // the records point into the input, so keep it mapped until they are solved
+  std::unique_ptr<MappedFileSource> m;
+  Records r;
   if (inTest) {
     r = LoadInput(SampleInput);
   } else {
-    std::unique_ptr<MappedFileSource>m(new MappedFileSource(argc, argv));
+    m.reset(new MappedFileSource(argc, argv));
     std::string_view f(m->data(), m->size());
     r = LoadInput(f);
   }
 
-  int64_t part1 = 0;
-  int64_t part2 = 0;
-
-  std::tie(part1, part2) = r;
+  Count part1 = 0;
+  Count part2 = 0;
+  {
+    aoc::AutoTimer t1{"Parts 1 and 2"};
+    if (aoc::get_int_option(argc, argv, "--memo", 0)) {
+      std::unique_ptr<SuffixCache> cache(new SuffixCache());
+      std::tie(part1, part2) = SolveRecords(r, unfold, threads, cache.get());
+      std::cout << "Memo hits: " << cache->Hits() << " misses: " << cache->Misses() << std::endl;
+    } else {
+      std::tie(part1, part2) = SolveRecords(r, unfold, threads);
+    }
+  }
 
   aoc::print_results(part1, part2);
 
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+
+    // the shared cache must agree with the DP, and find repeats in the sample
+    std::unique_ptr<SuffixCache> cache(new SuffixCache());
+    const auto memo = SolveRecords(r, unfold, threads, cache.get());
+    std::cout << "Memo hits: " << cache->Hits() << " misses: " << cache->Misses() << std::endl;
+    aoc::assert_result(memo.first, SR_Part1);
+    aoc::assert_result(memo.second, SR_Part2);
+
+    // a Thue-Morse record and its complement share suffix hashes but no suffixes, so
+    // the cache must tell them apart; only the first fits the groups, one way
+    std::string thue_morse = "#";
+    std::string complement = "#";
+    for (uint32_t i = 0; i < 2048; i++) {
+      const bool odd = std::popcount(i) % 2;
+      thue_morse += odd ? '#' : '.';
+      complement += odd ? '.' : '#';
+    }
+    Records tm;
+    tm.patterns = { thue_morse, complement };
+    for (size_t i = 0; i < thue_morse.size();) {
+      const size_t end = std::min(thue_morse.find('.', i), thue_morse.size());
+      tm.groups.push_back(static_cast<int64_t>(end - i));
+      i = thue_morse.find('#', end);
+    }
+    const auto runs = tm.groups;
+    tm.groups.insert(tm.groups.end(), runs.begin(), runs.end());
+    tm.group_offsets = { 0, runs.size(), tm.groups.size() };
+    std::unique_ptr<SuffixCache> tm_cache(new SuffixCache());
+    aoc::assert_result(SolveRecords(tm, 1, 1, tm_cache.get()).first, 1);
   }
 
   return 0;
@@ -1,7 +1,14 @@
 #include "aoc/helpers.h"
+#include "aoc/cpu.h"
+
+#include <span>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace {
-  using Result = std::pair<int, int>;
+  using Result = std::pair<int64_t, int64_t>;
   using MappedFileSource = aoc::MappedFileSource<char>;
 
   constexpr std::string_view SampleInput(R"(Game 1: 3 blue, 4 red; 1 red, 2 green, 6 blue; 2 green
@@ -16,74 +23,192 @@ Game 5: 6 red, 1 blue, 3 green; 2 blue, 1 red, 2 green)");
   constexpr int64_t max_green = 13;
   constexpr int64_t max_blue = 14;
 
-  // If the game line is possible, return the Game ID, else 0
-  const auto ParseLine = [](std::string_view line) -> std::pair<int64_t, int64_t> {
+  enum CubeClass : uint8_t {
+    Other = 0,
+    Digit,
+    Red,
+    Green,
+    Blue,
+    EndOfLine,
+  };
+
+  // Per byte class; a colour is known from its first letter, and then the rest of the
+  // word is skipped (it must be, as "green" contains an 'r')
+  struct CubeBytes {
+    uint8_t cls[256];
+    uint8_t skip[256];
+
+    constexpr CubeBytes()
+      : cls()
+      , skip() {
+        for (int c = '0'; c <= '9'; c++) {
+          cls[c] = Digit;
+        }
+        cls[static_cast<uint8_t>('r')] = Red;
+        skip[static_cast<uint8_t>('r')] = sizeof("red") - 1;
+        cls[static_cast<uint8_t>('g')] = Green;
+        skip[static_cast<uint8_t>('g')] = sizeof("green") - 1;
+        cls[static_cast<uint8_t>('b')] = Blue;
+        skip[static_cast<uint8_t>('b')] = sizeof("blue") - 1;
+        cls[static_cast<uint8_t>('\n')] = EndOfLine;
+        cls[static_cast<uint8_t>('\r')] = EndOfLine;
+      }
+  };
+
+  constexpr CubeBytes CUBE_BYTES;
+
+  struct Game {
+    int64_t id;
+    int64_t red;
+    int64_t green;
+    int64_t blue;
+  };
+
+  // Single pass over the whole log, calling op(game) as each game ends
+  template<typename Op>
+  void ParseGames(std::string_view f, Op op) {
     constexpr size_t prefix_len = sizeof("Game ") - 1;
-    // eat the "Game " prefix:
-    line.remove_prefix(prefix_len);
-
-    // read the Id (evertything up to a ':')
-    int64_t id = 0;
-    const auto id_end = line.find(':');
-    id = aoc::stoi(line.substr(0, id_end));
-
-    // skip the ':'
-    line.remove_prefix(id_end + 1);
-
-    int64_t game_max_red = 0;
-    int64_t game_max_green = 0;
-    int64_t game_max_blue = 0;
-    // look until the end
-    while (!line.empty()) {
-      // skip the leading ' '
-      line.remove_prefix(1);
-      const auto quant_end = line.find(' ');
-      const auto quant = aoc::stoi(line.substr(0, quant_end));
-      line.remove_prefix(quant_end + 1);
-      // read the color
-      const auto color_end = line.find_first_of(",;");
-      const auto color = line.substr(0, color_end);
-      line.remove_prefix(color_end);
-      line.remove_prefix(1);
-
-      if (color == "red") {
-        game_max_red = std::max(game_max_red, quant);
-
-        if (quant > max_red) {
-          DEBUG_PRINT("id: " << id << " red: " << quant << " > " << max_red);
-          id = 0;
+    const char* p = f.data();
+    const char* const end = p + f.size();
+
+    while (p < end) {
+      if (CUBE_BYTES.cls[static_cast<uint8_t>(*p)] == EndOfLine) {
+        p++;
+        continue;
+      }
+
+      // eat the "Game " prefix and read the id up to the ':'
+      p += prefix_len;
+      Game g{0, 0, 0, 0};
+      for (; p < end && *p != ':'; p++) {
+        g.id = g.id * 10 + (*p - '0');
+      }
+
+      int64_t n = 0;
+      for (; p < end; p++) {
+        const auto c = static_cast<uint8_t>(*p);
+        const auto cls = CUBE_BYTES.cls[c];
+        if (cls == Digit) {
+          n = n * 10 + (c - '0');
+          continue;
+        } else if (cls == EndOfLine) {
+          break;
         }
-      } else if (color == "green") {
-        game_max_green = std::max(game_max_green, quant);
-        if (quant > max_green) {
-          DEBUG_PRINT("id: " << id << " green: " << quant << " > " << max_green);
-          id = 0;
+        switch (cls) {
+          case Red: g.red = std::max(g.red, n); break;
+          case Green: g.green = std::max(g.green, n); break;
+          case Blue: g.blue = std::max(g.blue, n); break;
+          default: continue;
         }
-      } else if (color == "blue") {
-        game_max_blue = std::max(game_max_blue, quant);
-        if (quant > max_blue) {
-          DEBUG_PRINT("id: " << id << " blue: " << quant << " > " << max_blue);
-          id = 0;
+        DEBUG_PRINT("id: " << g.id << " " << *p << ": " << n);
+        n = 0;
+        p += CUBE_BYTES.skip[c] - 1;
+      }
+      op(g);
+    }
+  }
+
+  struct BagLimits {
+    int32_t red;
+    int32_t green;
+    int32_t blue;
+  };
+
+  // Sum the ids in [b, e) of the games whose maxima are all within the limits
+  int64_t SumPossibleScalar(const int32_t* ids, const int32_t* reds, const int32_t* greens, const int32_t* blues,
+      size_t b, size_t e, BagLimits l) {
+    int64_t sum = 0;
+    for (size_t i = b; i < e; i++) {
+      const int32_t possible = (reds[i] <= l.red) & (greens[i] <= l.green) & (blues[i] <= l.blue);
+      sum += ids[i] & -possible;
+    }
+    return sum;
+  }
+
+#if defined(__x86_64__)
+  // Eight games at a time: the three compares make a mask of impossible games, the
+  // ids of the rest are widened to 64 bits and summed in four lanes
+  __attribute__((target("avx2")))
+  int64_t SumPossibleAVX2(const int32_t* ids, const int32_t* reds, const int32_t* greens, const int32_t* blues,
+      size_t b, size_t e, BagLimits l) {
+    const __m256i red = _mm256_set1_epi32(l.red);
+    const __m256i green = _mm256_set1_epi32(l.green);
+    const __m256i blue = _mm256_set1_epi32(l.blue);
+    __m256i acc = _mm256_setzero_si256();
+
+    size_t i = b;
+    for (; i + 8 <= e; i += 8) {
+      const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(reds + i));
+      const __m256i g = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(greens + i));
+      const __m256i bl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blues + i));
+      const __m256i over = _mm256_or_si256(_mm256_cmpgt_epi32(r, red),
+        _mm256_or_si256(_mm256_cmpgt_epi32(g, green), _mm256_cmpgt_epi32(bl, blue)));
+      const __m256i v = _mm256_andnot_si256(over, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i)));
+      acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+      acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SumPossibleScalar(ids, reds, greens, blues, i, e, l);
+  }
+#endif
+
+  // Per game maxima kept as columns, so a limit query is a filter over flat arrays
+  struct GameTable {
+    std::vector<int32_t> Ids;
+    std::vector<int32_t> Reds;
+    std::vector<int32_t> Greens;
+    std::vector<int32_t> Blues;
+
+    void add(const Game& g) {
+      Ids.push_back(g.id);
+      Reds.push_back(g.red);
+      Greens.push_back(g.green);
+      Blues.push_back(g.blue);
+    }
+
+    size_t size() const {
+      return Ids.size();
+    }
+
+    int64_t SumPossibleBlock(size_t b, size_t e, BagLimits l) const {
+#if defined(__x86_64__)
+      if (aoc::has_avx2()) {
+        return SumPossibleAVX2(Ids.data(), Reds.data(), Greens.data(), Blues.data(), b, e, l);
+      }
+#endif
+      return SumPossibleScalar(Ids.data(), Reds.data(), Greens.data(), Blues.data(), b, e, l);
+    }
+
+    // Sum of the ids of the games possible under each set of limits.  Games are
+    // walked in cache-sized blocks, with every query run over a block in turn.
+    std::vector<int64_t> SumPossible(std::span<const BagLimits> queries) const {
+      constexpr size_t BlockSize = 4096;
+      std::vector<int64_t> out(queries.size(), 0);
+      for (size_t b = 0; b < size(); b += BlockSize) {
+        const size_t e = std::min(size(), b + BlockSize);
+        for (size_t q = 0; q < queries.size(); q++) {
+          out[q] += SumPossibleBlock(b, e, queries[q]);
         }
       }
-      DEBUG_PRINT(color << ": " << quant);
-      if (color_end == std::string_view::npos) {
-        break;
+      return out;
+    }
+
+    int64_t SumPower() const {
+      int64_t sum = 0;
+      for (size_t i = 0; i < size(); i++) {
+        sum += static_cast<int64_t>(Reds[i]) * Greens[i] * Blues[i];
       }
-      DEBUG_PRINT("line: " << line);
+      return sum;
     }
-    
-    return { id, game_max_red * game_max_blue * game_max_green};
   };
 
   const auto LoadInput = [](auto f) {
-    Result r{0, 0};
-    std::string_view line;
-    while (aoc::getline(f, line)) {
-      auto lr = ParseLine(line);
-      r.first += lr.first;
-      r.second += lr.second;
-    }
+    GameTable r;
+    ParseGames(f, [&r](const Game& g) {
+      r.add(g);
+    });
     return r;
   };
 }
@@ -92,17 +217,20 @@ int main(int argc, char** argv) {
   aoc::AutoTimer t;
   const bool inTest = argc < 2;
 
-  Result r;
+  GameTable games;
   if (inTest) {
-    r = LoadInput(SampleInput);
+    games = LoadInput(SampleInput);
   } else {
     std::unique_ptr<MappedFileSource>m(new MappedFileSource(argc, argv));
     std::string_view f(m->data(), m->size());
-    r = LoadInput(f);
+    games = LoadInput(f);
   }
 
-  int part1 = 0;
-  int part2 = 0;
+  const std::array<BagLimits, 1> bag{ { { max_red, max_green, max_blue } } };
+  Result r{ games.SumPossible(bag).front(), games.SumPower() };
+
+  int64_t part1 = 0;
+  int64_t part2 = 0;
 
   std::tie(part1, part2) = r;
 
@@ -111,6 +239,31 @@ int main(int argc, char** argv) {
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+
+    // check a batch of limits against scoring each game on its own, over 185 games so
+    // the last block is not a whole number of vectors
+    constexpr int64_t Copies = 37;
+    std::vector<Game> sample;
+    ParseGames(SampleInput, [&sample](const Game& g) { sample.push_back(g); });
+    GameTable copies;
+    for (int64_t c = 0; c < Copies; c++) {
+      for (const auto& g : sample) {
+        copies.add(g);
+      }
+    }
+    std::vector<BagLimits> queries;
+    for (int32_t l = 0; l < 24; l++) {
+      queries.push_back({ l, 24 - l, (l * 7) % 24 });
+    }
+    std::vector<int64_t> expected(queries.size(), 0);
+    for (size_t q = 0; q < queries.size(); q++) {
+      for (const auto& g : sample) {
+        if (g.red <= queries[q].red && g.green <= queries[q].green && g.blue <= queries[q].blue) {
+          expected[q] += g.id * Copies;
+        }
+      }
+    }
+    aoc::assert_results(copies.SumPossible(queries), expected);
   }
 
   return 0;
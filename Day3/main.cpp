@@ -1,8 +1,8 @@
 #include "aoc/helpers.h"
-#include "aoc/padded_matrix.h"
+#include "aoc/parallel.h"
 
 namespace {
-  using Result = std::pair<int, int>;
+  using Result = std::pair<int64_t, int64_t>;
   using MappedFileSource = aoc::MappedFileSource<char>;
 
   constexpr std::string_view SampleInput(R"(467..114..
@@ -18,153 +18,269 @@ namespace {
   constexpr int SR_Part1 = 4361;
   constexpr int SR_Part2 = 467835;
 
-  const auto LoadInput = [](auto f, aoc::PaddedMatrix<char>& m) {
-    std::string_view line;
-    while (aoc::getline(f, line)) {
-      m.set_width(line.size());
-      const auto row = m.add_row();
-      for (size_t i = 0; i < line.size(); ++i) {
-        m.add(i, row, line[i]);
-      }
-    }
-    m.fill_pddding('.');
-  };
-}
+  using Row = std::string_view;
 
-int main(int argc, char** argv) {
-  aoc::AutoTimer t;
-  const bool inTest = argc < 2;
-
-  aoc::PaddedMatrix<char> map;
-  if (inTest) {
-    LoadInput(SampleInput, map);
-  } else {
-    std::unique_ptr<MappedFileSource>m(new MappedFileSource(argc, argv));
-    std::string_view f(m->data(), m->size());
-    LoadInput(f, map);
+  constexpr char At(Row r, ssize_t x) {
+    return (x >= 0 && x < static_cast<ssize_t>(r.size())) ? r[x] : '.';
   }
-  t.elapsed();
-  t.reset();
-  int64_t part1 = 0;
-  int64_t part2 = 0;
 
-  // scan the map to look for runs of numbers, then for each run of numerics, see if there is an adjacent symbol
-  for (ssize_t y = 0; y < map.get_height(); ++y) {
-    ssize_t runStart = 0;
-    bool inRun = false;
-    size_t val = 0;
-    const auto is_point_symbol = [&map](ssize_t x, ssize_t y) -> bool {
-      const auto v = map.at(x,y);
-      return v != '.' && !aoc::is_numeric(v);
-    };
-    const auto get_number_value = [&map](ssize_t x, ssize_t y) -> int64_t {
-      int64_t v = 0;
-      while (aoc::is_numeric(map.at(x, y))) {
-        v *= 10;
-        v += map.at(x, y) - '0';
-        x++;
-      }
-      return v;
-    };
-
-    const auto is_point_numeric = [&map](ssize_t x, ssize_t y) -> bool {
-      const auto v = map.at(x, y);
-      return aoc::is_numeric(v);
-    };
-
-    const auto find_number_start = [&map](ssize_t x, ssize_t y) -> ssize_t {
-      ssize_t x_off = 1;
-      while (aoc::is_numeric(map.at(x - x_off, y))) {
-        x_off++;
-      }
-      x_off--;
-      return x - x_off;
-    };
+  constexpr bool IsSymbol(char c) {
+    return c != '.' && !aoc::is_numeric(c);
+  }
 
+  // Value of the number which covers column x
+  int64_t NumberAt(Row r, ssize_t x) {
+    while (aoc::is_numeric(At(r, x - 1))) {
+      x--;
+    }
+    int64_t v = 0;
+    while (aoc::is_numeric(At(r, x))) {
+      v *= 10;
+      v += r[x++] - '0';
+    }
+    return v;
+  }
 
-    for (ssize_t x = 0; x < map.get_width() + 1; ++x) {
+  // Call op(value) for each number in the row touching columns x - 1 to x + 1
+  template<typename Op>
+  void ForEachAdjacentNumber(Row r, ssize_t x, Op op) {
+    // a number over x covers any others
+    if (aoc::is_numeric(At(r, x))) {
+      op(NumberAt(r, x));
+      return;
+    }
+    if (aoc::is_numeric(At(r, x - 1))) {
+      op(NumberAt(r, x - 1));
+    }
+    if (aoc::is_numeric(At(r, x + 1))) {
+      op(NumberAt(r, x + 1));
+    }
+  }
 
-      // Part 1
-      if (!inRun && is_point_numeric(x, y)) {
-        inRun = true;
-        runStart = x;
-        val = map.at(x, y) - '0';
-      } else if (inRun && !is_point_numeric(x, y)) {
-        inRun = false;
+  // Both parts for the middle row of a three row window
+  Result ScanRow(Row prev, Row cur, Row next) {
+    Result r{0, 0};
+    const auto width = static_cast<ssize_t>(cur.size());
+    ssize_t x = 0;
+    while (x < width) {
+      if (aoc::is_numeric(cur[x])) {
+        const auto start = x;
+        int64_t val = 0;
+        while (x < width && aoc::is_numeric(cur[x])) {
+          val *= 10;
+          val += cur[x++] - '0';
+        }
 
         // only if one of adject points is a symbol (i.e. not numeric and not a '.'), do we include it in the sum
         bool valid = false;
-
-        valid = is_point_symbol(runStart - 1, y) || is_point_symbol(x, y);
-
-        for (ssize_t lx = runStart - 1; !valid && lx < x + 1; lx++) {
-          valid = (is_point_symbol(lx, y - 1) ||
-            is_point_symbol(lx, y + 1));
+        for (ssize_t lx = start - 1; !valid && lx <= x; lx++) {
+          valid = IsSymbol(At(prev, lx)) || IsSymbol(At(cur, lx)) || IsSymbol(At(next, lx));
         }
-
         DEBUG_PRINT("valid: " << valid << " val: " << val);
         if (valid) {
-          part1 += val;
+          r.first += val;
         }
-      } else if (inRun) {
-        val *= 10;
-        val += map.at(x, y) - '0';
+        continue;
       }
 
-      // part 2
-      if (map.at(x, y) == '*') {
-        // find adjacent numbers
-        std::vector<int64_t> adj;
-
-        // ? N ?
-        // N * N
-        // ? N ?
-        const std::array<aoc::Point, 4> cardinal_dirs = {
-          aoc::Point(x - 1, y),
-          aoc::Point(x + 1, y),
-          aoc::Point(x, y - 1),
-          aoc::Point(x, y + 1)
-        };
-        for (auto dir : cardinal_dirs) {
-          if (is_point_numeric(dir.first, dir.second)) {
-            const auto start = find_number_start(dir.first, dir.second);
-            const auto v = get_number_value(start, dir.second);
-            adj.push_back(v);
-            DEBUG_PRINT("adj(" << dir.first << ", " << dir.second << "): " << v);
-          }
+      if (cur[x] == '*') {
+        int adj = 0;
+        int64_t ratio = 1;
+        for (const auto row : { prev, cur, next }) {
+          ForEachAdjacentNumber(row, x, [&adj, &ratio](int64_t v) {
+            adj++;
+            ratio *= v;
+          });
+        }
+        if (adj == 2) {
+          DEBUG_PRINT("part2: " << ratio);
+          r.second += ratio;
         }
+      }
+      x++;
+    }
+    return r;
+  }
+
+  // Stream the schematic with a window of three rows viewed straight from the input,
+  // so memory use does not grow with the size of the schematic
+  const auto LoadInput = [](auto f) {
+    Result r{0, 0};
+    Row prev;
+    Row cur;
+    Row next;
+    bool more = aoc::getline(f, cur);
+    while (more) {
+      next = Row();
+      more = aoc::getline(f, next);
+      const auto rr = ScanRow(prev, cur, next);
+      r.first += rr.first;
+      r.second += rr.second;
+      prev = cur;
+      cur = next;
+    }
+    return r;
+  };
 
-        // N . N
-        // . * .
-        // N . N
-        const std::array<aoc::Point, 4> diagonal_dirs = {
-          aoc::Point(x - 1, y - 1),
-          aoc::Point(x - 1, y + 1),
-          aoc::Point(x + 1, y - 1),
-          aoc::Point(x + 1, y + 1)
-        };
-        for (auto dir : diagonal_dirs) {
-          if (is_point_numeric(dir.first, dir.second) && !is_point_numeric(x, dir.second)) {
-            const auto start = find_number_start(dir.first, dir.second);
-            const auto v = get_number_value(start, dir.second);
-            adj.push_back(v);
-            DEBUG_PRINT("adj(" << dir.first << ", " << dir.second << "): " << v);
+  // Every digit cell labelled with an id for its number (0 for none) and its value,
+  // so gear neighbours are constant time reads.  Numbers never span rows, so each
+  // band of rows can be labelled on its own; scoring then reads across band seams.
+  struct LabelGrid {
+    std::vector<Row> Rows;
+    ssize_t Width = 0;
+    // ids are cell offsets, which outgrow 32 bits on the grids this is for
+    std::vector<int64_t> Ids;
+    std::vector<int64_t> Values;
+
+    ssize_t Height() const {
+      return Rows.size();
+    }
+
+    ssize_t offset(ssize_t x, ssize_t y) const {
+      return y * Width + x;
+    }
+
+    int64_t IdAt(ssize_t x, ssize_t y) const {
+      if (x < 0 || x >= Width || y < 0 || y >= Height()) {
+        return 0;
+      }
+      return Ids[offset(x, y)];
+    }
+
+    void LabelRows(ssize_t begin, ssize_t end) {
+      for (ssize_t y = begin; y < end; y++) {
+        const auto row = Rows[y];
+        ssize_t x = 0;
+        while (x < static_cast<ssize_t>(row.size())) {
+          if (!aoc::is_numeric(row[x])) {
+            x++;
+            continue;
+          }
+          const auto start = x;
+          int64_t val = 0;
+          while (x < static_cast<ssize_t>(row.size()) && aoc::is_numeric(row[x])) {
+            val *= 10;
+            val += row[x++] - '0';
+          }
+          // the offset of its first digit makes the id unique without any coordination
+          const int64_t id = offset(start, y) + 1;
+          for (auto lx = start; lx < x; lx++) {
+            Ids[offset(lx, y)] = id;
+            Values[offset(lx, y)] = val;
           }
         }
+      }
+    }
 
-        if (adj.size() == 2) {
-          DEBUG_PRINT("part2: " << adj[0] << " * " << adj[1]);
-          part2 += (adj[0] * adj[1]);
+    Result ScoreRows(ssize_t begin, ssize_t end) const {
+      Result r{0, 0};
+      const auto row_at = [this](ssize_t y) {
+        return (y >= 0 && y < Height()) ? Rows[y] : Row();
+      };
+      for (ssize_t y = begin; y < end; y++) {
+        const auto prev = row_at(y - 1);
+        const auto cur = Rows[y];
+        const auto next = row_at(y + 1);
+        for (ssize_t x = 0; x < static_cast<ssize_t>(cur.size()); x++) {
+          const auto id = IdAt(x, y);
+          if (id && IdAt(x - 1, y) != id) {
+            // first digit of a number
+            auto last = x;
+            while (IdAt(last + 1, y) == id) {
+              last++;
+            }
+            bool valid = false;
+            for (ssize_t lx = x - 1; !valid && lx <= last + 1; lx++) {
+              valid = IsSymbol(At(prev, lx)) || IsSymbol(At(cur, lx)) || IsSymbol(At(next, lx));
+            }
+            if (valid) {
+              r.first += Values[offset(x, y)];
+            }
+          } else if (cur[x] == '*') {
+            // at most two numbers in each of the rows above and below, one either side
+            int64_t seen[6];
+            int adj = 0;
+            int64_t ratio = 1;
+            for (ssize_t ly = y - 1; ly <= y + 1; ly++) {
+              for (ssize_t lx = x - 1; lx <= x + 1; lx++) {
+                const auto n = IdAt(lx, ly);
+                if (!n || std::find(seen, seen + adj, n) != seen + adj) {
+                  continue;
+                }
+                seen[adj++] = n;
+                ratio *= Values[offset(lx, ly)];
+              }
+            }
+            if (adj == 2) {
+              r.second += ratio;
+            }
+          }
         }
       }
+      return r;
     }
+  };
+
+  // Label the grid, then score it, both passes split into bands of rows
+  const auto LoadInputLabelled = [](auto f, size_t threads) {
+    LabelGrid g;
+    Row line;
+    while (aoc::getline(f, line)) {
+      g.Rows.push_back(line);
+      g.Width = std::max(g.Width, static_cast<ssize_t>(line.size()));
+    }
+    g.Ids.resize(g.Width * g.Height());
+    g.Values.resize(g.Width * g.Height());
+
+    aoc::parallel_for(g.Height(), threads, [&g](size_t begin, size_t end) {
+      g.LabelRows(begin, end);
+    });
+
+    // each band's sums are kept against its first row
+    std::vector<Result> bands(g.Height(), Result{0, 0});
+    aoc::parallel_for(g.Height(), threads, [&g, &bands](size_t begin, size_t end) {
+      bands[begin] = g.ScoreRows(begin, end);
+    });
+
+    Result r{0, 0};
+    for (const auto& b : bands) {
+      r.first += b.first;
+      r.second += b.second;
+    }
+    return r;
+  };
+}
+
+int main(int argc, char** argv) {
+  aoc::AutoTimer t;
+  const bool inTest = argc < 2;
+
+  // the input is streamed unless --labelled 1 asks for the labelled grid, which is
+  // built over --threads threads
+  const bool labelled = aoc::get_int_option(argc, argv, "--labelled", 0);
+  const size_t threads = aoc::get_int_option(argc, argv, "--threads", aoc::default_thread_count());
+
+  Result r;
+  if (inTest) {
+    r = LoadInput(SampleInput);
+  } else {
+    std::unique_ptr<MappedFileSource>m(new MappedFileSource(argc, argv));
+    std::string_view f(m->data(), m->size());
+    r = labelled ? LoadInputLabelled(f, threads) : LoadInput(f);
   }
 
+  int64_t part1 = 0;
+  int64_t part2 = 0;
+
+  std::tie(part1, part2) = r;
+
   aoc::print_results(part1, part2);
 
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+    aoc::assert_result(LoadInputLabelled(SampleInput, 3), r);
+    aoc::assert_result(LoadInputLabelled(SampleInput, threads), r);
   }
 
   return 0;
@@ -1,12 +1,15 @@
 #include "aoc/helpers.h"
 
-#include <set>
-#include <map>
+#include <algorithm>
+#include <bit>
+#include <array>
+#include <stdexcept>
 #include <vector>
-#include <cmath>
 
 namespace {
-  using Result = std::pair<int, int>;
+  // a card can score up to 2^127, so part 1 is kept in unsigned 128 bits
+  using Wide = unsigned __int128;
+  using Result = std::pair<Wide, int64_t>;
   using MappedFileSource = aoc::MappedFileSource<char>;
 
   constexpr std::string_view SampleInput(R"(Card 1: 41 48 83 86 17 | 83 86  6 31 17  9 48 53
@@ -15,73 +18,104 @@ Card 3:  1 21 53 59 44 | 69 82 63 72 16 21 14  1
 Card 4: 41 92 73 84 69 | 59 84 76 51 58  5 54 83
 Card 5: 87 83 26 28 32 | 88 30 70 12 93 22 82 36
 Card 6: 31 18 13 56 72 | 74 77 10 23 35 67 36 11)");
-  constexpr int SR_Part1 = 13;
+  constexpr Wide SR_Part1 = 13;
   constexpr int SR_Part2 = 30;
+  constexpr std::string_view SR_RangeError("Card number out of range");
+  constexpr std::string_view SR_CopiesError("Card copies overflow 64 bits");
+  constexpr std::string_view SR_ScoreError("Card scores overflow 128 bits");
+
+  // Card numbers fit in 0..127, so each side of a card is a 128 bit set
+  using CardMask = unsigned __int128;
+  constexpr uint32_t MaxCardNumber = 127;
+
+  constexpr int32_t CountMatches(CardMask a, CardMask b) {
+    const CardMask both = a & b;
+    return std::popcount(static_cast<uint64_t>(both)) + std::popcount(static_cast<uint64_t>(both >> 64));
+  }
+
+  CardMask CardBit(uint32_t n) {
+    if (n > MaxCardNumber) {
+      throw std::runtime_error("Card number out of range");
+    }
+    return CardMask{1} << n;
+  }
 
   const auto ParseLine = [](std::string_view line) -> int32_t {
+    const char* p = line.data();
+    const char* const end = p + line.size();
+
     // eat the part up to the colon
-    const auto n = line.find(':');
-    line.remove_prefix(n + 1);
-    while (line.front() == ' ') {
-      line.remove_prefix(1);
+    while (p < end && *p != ':') {
+      p++;
     }
 
-    // split at the '|', the left is the card, the right is the winning numbers
-    const auto m = line.find('|');
-    const auto card = line.substr(0, m);
-    line.remove_prefix(m + 1);
-    while (line.front() == ' ') {
-      line.remove_prefix(1);
+    // the left of the '|' is the card, the right is the winning numbers; numbers go
+    // straight into the masks as they are read
+    CardMask sides[2] = { 0, 0 };
+    size_t side = 0;
+    uint32_t n = 0;
+    bool in_number = false;
+    for (p++; p < end; p++) {
+      const char c = *p;
+      if (aoc::is_numeric(c)) {
+        // saturate, so a long run of digits cannot wrap back into range
+        n = std::min(n * 10 + (c - '0'), MaxCardNumber + 1);
+        in_number = true;
+        continue;
+      }
+      if (in_number) {
+        sides[side] |= CardBit(n);
+      }
+      n = 0;
+      in_number = false;
+      side |= (c == '|');
+    }
+    if (in_number) {
+      sides[side] |= CardBit(n);
     }
-    const auto winning = line;
-
-    // convert the space seperated list into a set
-    std::set<int64_t> card_set;
-    aoc::parse_as_integers(card, ' ', [&card_set](const auto n) { card_set.insert(n); });
 
     // count the number of matches from winning numbers in the card
-    int32_t count = 0;
-    aoc::parse_as_integers(winning, ' ', [&count, &card_set](const auto n) {
-      count += card_set.count(n);
-    });
-
-    return count;
+    return CountMatches(sides[0], sides[1]);
   };
 
+  // A card can match at most MaxCardNumber + 1 numbers, so its copies only ever
+  // reach less than this far ahead
+  constexpr size_t PendingSize = 256;
+  static_assert(PendingSize > MaxCardNumber + 1);
+
   const auto LoadInput = [](auto f) {
     Result r{0, 0};
     std::string_view line;
-    std::vector<std::pair<int32_t, int32_t>>card_wins;
-    int32_t idx = 1;
+    // copies won of the cards ahead of this one, indexed by card number mod the size
+    std::array<int64_t, PendingSize> pending{};
+    size_t idx = 0;
     while (aoc::getline(f, line)) {
       const auto n = ParseLine(line);
       if (n > 0) {
         // part 1 is trivial 2^(number of wins - 1)
-        r.first += std::pow(2, n - 1);
+        const Wide score = Wide{1} << (n - 1);
+        if (__builtin_add_overflow(r.first, score, &r.first)) {
+          throw std::overflow_error("Card scores overflow 128 bits");
+        }
       }
-      // part 2 requires some state
-      card_wins.push_back({idx++, n});
-    }
 
-    // determine, for each card, how many we win of the next cards in the set
-    std::map<int32_t, int32_t> extra_copies;
-    for (const auto& [i, n] : card_wins) {
-      const auto idx = extra_copies.find(i);
-      const int32_t current_num = (idx == extra_copies.end() ? 0 : idx->second) + 1;
-      // now increment number of the next cards by the number of the current card, plus this instance
-      for (int32_t j = 1; j < n + 1; ++j) {
-        auto it = extra_copies.emplace(i + j, 0);
-        it.first->second += current_num;
+      // part 2 is the instances of this card, each of which wins a copy of the next n;
+      // the copies can grow as fast as the Fibonacci numbers, so refuse to wrap
+      auto& slot = pending[idx % PendingSize];
+      int64_t copies;
+      bool overflow = __builtin_add_overflow(slot, 1, &copies);
+      slot = 0;
+      overflow |= __builtin_add_overflow(r.second, copies, &r.second);
+      for (int32_t j = 1; j <= n; ++j) {
+        auto& ahead = pending[(idx + j) % PendingSize];
+        overflow |= __builtin_add_overflow(ahead, copies, &ahead);
+      }
+      if (overflow) {
+        throw std::overflow_error("Card copies overflow 64 bits");
       }
+      idx++;
     }
 
-    // part 2 result is total number of extra cards we won
-    std::for_each(extra_copies.begin(), extra_copies.end(), [&r](auto& p) {
-      r.second += p.second;
-    });
-    // plus the number of cards we started with
-    r.second += card_wins.size();
-
     return r;
   };
 }
@@ -99,8 +133,8 @@ int main(int argc, char** argv) {
     r = LoadInput(f);
   }
 
-  int part1 = 0;
-  int part2 = 0;
+  Wide part1 = 0;
+  int64_t part2 = 0;
 
   std::tie(part1, part2) = r;
 
@@ -109,6 +143,55 @@ int main(int argc, char** argv) {
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+
+    // a card matching 0..69 on both sides scores 2^69, and one with a number past
+    // 127 is rejected rather than shifted out of the mask
+    std::string wide("Card 1:");
+    for (int i = 0; i < 70; i++) {
+      wide += " " + std::to_string(i);
+    }
+    wide += " |" + wide.substr(wide.find(':') + 1);
+    aoc::assert_result(LoadInput(std::string_view(wide)).first, Wide{1} << 69);
+
+    // a card matching 127 numbers wins a copy of each of the next 127 cards, all the
+    // way round the ring
+    std::string ring("Card 1:");
+    for (uint32_t i = 0; i < MaxCardNumber; i++) {
+      ring += " " + std::to_string(i);
+    }
+    ring += " |" + ring.substr(ring.find(':') + 1) + "\n";
+    for (uint32_t i = 0; i < MaxCardNumber; i++) {
+      ring += "Card 2: 1 | 2\n";
+    }
+    aoc::assert_result(LoadInput(std::string_view(ring)).second, int64_t{1 + 2 * MaxCardNumber});
+
+    const auto load_error = [](std::string_view cards) {
+      try {
+        LoadInput(cards);
+      } catch (const std::runtime_error& e) {
+        return std::string(e.what());
+      }
+      return std::string();
+    };
+    aoc::assert_result(load_error("Card 1: 1 128 | 1 2"), SR_RangeError);
+
+    // cards matching two numbers each grow their copies like the Fibonacci numbers,
+    // past int64 within a hundred cards
+    std::string fibonacci;
+    for (int i = 0; i < 100; i++) {
+      fibonacci += "Card 1: 1 2 | 1 2\n";
+    }
+    aoc::assert_result(load_error(fibonacci), SR_CopiesError);
+
+    // a card matching every number scores the most any card can, 2^127, so two of
+    // them cannot be summed
+    std::string full("Card 1:");
+    for (uint32_t i = 0; i <= MaxCardNumber; i++) {
+      full += " " + std::to_string(i);
+    }
+    full += " |" + full.substr(full.find(':') + 1) + "\n";
+    aoc::assert_result(LoadInput(std::string_view(full)).first, Wide{1} << 127);
+    aoc::assert_result(load_error(full + full), SR_ScoreError);
   }
 
   return 0;
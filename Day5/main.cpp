@@ -1,6 +1,14 @@
 #include "aoc/helpers.h"
+#include "aoc/cpu.h"
+#include "aoc/parallel.h"
 
+#include <algorithm>
 #include <map>
+#include <span>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace {
   using Result = std::pair<int, int>;
@@ -42,6 +50,32 @@ humidity-to-location map:
   constexpr int SR_Part1 = 35;
   constexpr int SR_Part2 = 46;
 
+  // seed 10 moves to 100, and nothing maps back onto 10, so the maps are not a
+  // permutation of the values they cover
+  constexpr std::string_view SampleInput2(R"(seeds: 10 1
+
+seed-to-soil map:
+100 10 1
+
+soil-to-fertilizer map:
+5000 6000 1
+
+fertilizer-to-water map:
+5000 6000 1
+
+water-to-light map:
+5000 6000 1
+
+light-to-temperature map:
+5000 6000 1
+
+temperature-to-humidity map:
+5000 6000 1
+
+humidity-to-location map:
+5000 6000 1)");
+  constexpr int SR_Part2_2 = 100;
+
   struct Range {
     int64_t start;
     int64_t end;
@@ -56,6 +90,10 @@ humidity-to-location map:
     {
     }
 
+    static Range FromFirstAndLast(int64_t first, int64_t last) {
+      return Range(first, last - first + 1);
+    }
+
     bool operator<(const Range& r) const {
       return start < r.start;
     }
@@ -66,6 +104,7 @@ humidity-to-location map:
   };
 
   using RangeMap = std::vector<std::pair<Range, Range>>;
+  using Ranges = std::vector<Range>;
 
   const auto LocateInMap = [](const RangeMap& m, int64_t v) -> int64_t {
     for (const auto& r : m) {
@@ -77,6 +116,155 @@ humidity-to-location map:
     return v;
   };
 
+  // Walk the (sorted) map over [first, last], calling op(first, last, delta) for each
+  // piece, where delta is the offset that piece is moved by; unmapped gaps get 0.
+  template<typename Op>
+  void SplitByMap(const RangeMap& m, int64_t first, int64_t last, Op op) {
+    auto it = std::upper_bound(m.begin(), m.end(), first, [](int64_t v, const auto& e) {
+      return v < e.first.start;
+    });
+    if (it != m.begin() && std::prev(it)->first.contains(first)) {
+      --it;
+    }
+    for (; it != m.end() && first <= last; ++it) {
+      const auto& src = it->first;
+      if (src.start > last) {
+        break;
+      }
+      if (src.start > first) {
+        op(first, src.start - 1, 0);
+        first = src.start;
+      }
+      const auto end = std::min(last, src.end);
+      op(first, end, it->second.start - src.start);
+      first = end + 1;
+    }
+    if (first <= last) {
+      op(first, last, 0);
+    }
+  }
+
+  // Sort and coalesce overlapping or adjacent ranges
+  void MergeRanges(Ranges& r) {
+    if (r.empty()) {
+      return;
+    }
+    std::sort(r.begin(), r.end());
+    size_t out = 0;
+    for (size_t i = 1; i < r.size(); i++) {
+      if (r[i].start <= r[out].end + 1) {
+        r[out].end = std::max(r[out].end, r[i].end);
+      } else {
+        r[++out] = r[i];
+      }
+    }
+    r.erase(r.begin() + out + 1, r.end());
+  }
+
+  const auto PropagateThroughMap = [](const RangeMap& m, const Ranges& in) {
+    Ranges out;
+    for (const auto& r : in) {
+      SplitByMap(m, r.start, r.end, [&out](int64_t first, int64_t last, int64_t delta) {
+        out.push_back(Range::FromFirstAndLast(first + delta, last + delta));
+      });
+    }
+    MergeRanges(out);
+    return out;
+  };
+
+  // A piece of the composed seed->location function: [first, last] moves by offset
+  struct Segment {
+    int64_t first;
+    int64_t last;
+    int64_t offset;
+  };
+  using Segments = std::vector<Segment>;
+
+  // Feed the image of each segment through the next map, keeping the result sorted
+  // by source and coalescing neighbours which end up with the same offset
+  const auto ComposeMap = [](const Segments& in, const RangeMap& m) {
+    Segments out;
+    for (const auto& s : in) {
+      SplitByMap(m, s.first + s.offset, s.last + s.offset, [&out, &s](int64_t first, int64_t last, int64_t delta) {
+        const Segment n{ first - s.offset, last - s.offset, s.offset + delta };
+        if (!out.empty() && out.back().offset == n.offset && out.back().last + 1 == n.first) {
+          out.back().last = n.last;
+        } else {
+          out.push_back(n);
+        }
+      });
+    }
+    return out;
+  };
+
+  // Locate seeds in a composed table of `segments` sorted starts in lock-step: every
+  // lane does the same number of branch-free halving steps, so the loads for a block
+  // of seeds are all in flight at once
+  void LocateBlockScalar(const int64_t* starts, const int64_t* offsets, size_t segments,
+      const int64_t* seeds, int64_t* out, size_t count) {
+    constexpr size_t Lanes = 16;
+    size_t lo[Lanes];
+
+    for (size_t i = 0; i < count; i += Lanes) {
+      const size_t lanes = std::min(Lanes, count - i);
+      for (size_t l = 0; l < lanes; l++) {
+        lo[l] = 0;
+      }
+      for (size_t n = segments; n > 1; ) {
+        const size_t half = n / 2;
+        for (size_t l = 0; l < lanes; l++) {
+          lo[l] += (starts[lo[l] + half] <= seeds[i + l]) * half;
+        }
+        n -= half;
+      }
+      for (size_t l = 0; l < lanes; l++) {
+        const auto v = seeds[i + l];
+        out[i + l] = v + (offsets[lo[l]] & -static_cast<int64_t>(v >= starts[0]));
+      }
+    }
+  }
+
+#if defined(__x86_64__)
+  // The same search four seeds to a register, sixteen at a time: each halving step
+  // gathers the probed starts and advances the lanes whose start is not above
+  // their seed
+  __attribute__((target("avx2")))
+  void LocateBlockAVX2(const int64_t* starts, const int64_t* offsets, size_t segments,
+      const int64_t* seeds, int64_t* out, size_t count) {
+    constexpr size_t Vectors = 4;
+    constexpr size_t Block = Vectors * 4;
+    const auto* s64 = reinterpret_cast<const long long*>(starts);
+    const auto* o64 = reinterpret_cast<const long long*>(offsets);
+    const __m256i first = _mm256_set1_epi64x(starts[0]);
+
+    size_t i = 0;
+    for (; i + Block <= count; i += Block) {
+      __m256i seed[Vectors];
+      __m256i lo[Vectors];
+      for (size_t v = 0; v < Vectors; v++) {
+        seed[v] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seeds + i + v * 4));
+        lo[v] = _mm256_setzero_si256();
+      }
+      for (size_t n = segments; n > 1; ) {
+        const size_t half = n / 2;
+        const __m256i h = _mm256_set1_epi64x(half);
+        for (size_t v = 0; v < Vectors; v++) {
+          const __m256i probe = _mm256_i64gather_epi64(s64, _mm256_add_epi64(lo[v], h), 8);
+          lo[v] = _mm256_add_epi64(lo[v], _mm256_andnot_si256(_mm256_cmpgt_epi64(probe, seed[v]), h));
+        }
+        n -= half;
+      }
+      for (size_t v = 0; v < Vectors; v++) {
+        const __m256i offset = _mm256_i64gather_epi64(o64, lo[v], 8);
+        const __m256i below = _mm256_cmpgt_epi64(first, seed[v]);
+        const __m256i r = _mm256_add_epi64(seed[v], _mm256_andnot_si256(below, offset));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + v * 4), r);
+      }
+    }
+    LocateBlockScalar(starts, offsets, segments, seeds + i, out + i, count - i);
+  }
+#endif
+
   struct Almanac {
     std::vector<int64_t> Seeds;
     RangeMap SeedToSoil;
@@ -86,6 +274,61 @@ humidity-to-location map:
     RangeMap LightToTemperature;
     RangeMap TemperatureToHumidity;
     RangeMap HumidityToLocation;
+    // all seven maps folded together, sorted by seed
+    Segments SeedToLocation;
+    // the same table split into columns for the batch lookup
+    std::vector<int64_t> SegmentStarts;
+    std::vector<int64_t> SegmentOffsets;
+
+    void Compose() {
+      SeedToLocation = { { 0, INT64_MAX - 1, 0 } };
+      for (const auto* m : { &SeedToSoil, &SoilToFertilizer, &FertilizerToWater, &WaterToLight,
+                             &LightToTemperature, &TemperatureToHumidity, &HumidityToLocation }) {
+        SeedToLocation = ComposeMap(SeedToLocation, *m);
+      }
+      SegmentStarts.clear();
+      SegmentOffsets.clear();
+      for (const auto& s : SeedToLocation) {
+        SegmentStarts.push_back(s.first);
+        SegmentOffsets.push_back(s.offset);
+      }
+      DEBUG_PRINT("Composed " << SeedToLocation.size() << " segments");
+    }
+
+    // Single binary search over the composed table
+    int64_t Locate(int64_t seed) const {
+      auto it = std::upper_bound(SeedToLocation.begin(), SeedToLocation.end(), seed, [](int64_t v, const auto& s) {
+        return v < s.first;
+      });
+      if (it == SeedToLocation.begin()) {
+        return seed;
+      }
+      return seed + std::prev(it)->offset;
+    }
+
+    // Locate one thread's share of a batch
+    void LocateBlock(const int64_t* seeds, int64_t* out, size_t count) const {
+#if defined(__x86_64__)
+      if (aoc::has_avx2()) {
+        LocateBlockAVX2(SegmentStarts.data(), SegmentOffsets.data(), SegmentStarts.size(), seeds, out, count);
+        return;
+      }
+#endif
+      LocateBlockScalar(SegmentStarts.data(), SegmentOffsets.data(), SegmentStarts.size(), seeds, out, count);
+    }
+
+    // Batch lookup, split over threads; by default only batches large enough to
+    // pay for the thread start-up are split
+    void LocateBatch(std::span<const int64_t> seeds, std::span<int64_t> out, size_t threads = 0) const {
+      assert(seeds.size() == out.size());
+      if (!threads) {
+        constexpr size_t MinPerThread = 1 << 16;
+        threads = std::min(aoc::default_thread_count(), std::max<size_t>(1, seeds.size() / MinPerThread));
+      }
+      aoc::parallel_for(seeds.size(), threads, [this, &seeds, &out](size_t begin, size_t end) {
+        LocateBlock(seeds.data() + begin, out.data() + begin, end - begin);
+      });
+    }
 
     int64_t GetSeedLocation(int64_t seed) const {
       // locate the soil from the seed->soil map
@@ -104,6 +347,52 @@ humidity-to-location map:
       DEBUG_PRINT("Humidity: " << humidity);
       return LocateInMap(HumidityToLocation, humidity);
     }
+
+    // Push whole seed intervals through each map; the cost scales with the number
+    // of map entries rather than the number of seeds.
+    Ranges GetLocationRanges(Ranges r) const {
+      MergeRanges(r);
+      for (const auto* m : { &SeedToSoil, &SoilToFertilizer, &FertilizerToWater, &WaterToLight,
+                             &LightToTemperature, &TemperatureToHumidity, &HumidityToLocation }) {
+        r = PropagateThroughMap(*m, r);
+      }
+      return r;
+    }
+  };
+
+  // The almanac run backwards, location to seed.  The composed table's segments are
+  // ordered by the lowest location each one reaches; segments can overlap there, as
+  // several seeds may share a location.
+  struct ReverseAlmanac {
+    Segments ByLocation;
+
+    explicit ReverseAlmanac(const Almanac& a)
+      : ByLocation(a.SeedToLocation)
+    {
+      std::sort(ByLocation.begin(), ByLocation.end(), [](const auto& a, const auto& b) {
+        return a.first + a.offset < b.first + b.offset;
+      });
+    }
+
+    // Visit segments by their lowest location, taking the lowest seed of each which
+    // lies in a seed range, until no later segment can reach below the best so far
+    int64_t FindLowestLocation(Ranges seeds) const {
+      MergeRanges(seeds);
+      int64_t best = INT64_MAX;
+      for (const auto& s : ByLocation) {
+        if (s.first + s.offset >= best) {
+          break;
+        }
+        const auto it = std::lower_bound(seeds.begin(), seeds.end(), s.first, [](const auto& r, int64_t v) {
+          return r.end < v;
+        });
+        if (it != seeds.end() && it->start <= s.last) {
+          DEBUG_PRINT("Segment " << s.first << "-" << s.last << " reaches seed " << std::max(it->start, s.first));
+          best = std::min(best, std::max(it->start, s.first) + s.offset);
+        }
+      }
+      return best;
+    }
   };
 
   const auto ParseMap = [](auto& f, RangeMap& r) {
@@ -119,6 +408,7 @@ humidity-to-location map:
       DEBUG_PRINT("Destination: " << values[0] << " Source: " << values[1] << " Range: " << values[2]);
       r.emplace_back(Range(values[1], values[2]), Range(values[0], values[2]));
     }
+    std::sort(r.begin(), r.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
   };
       
 
@@ -181,6 +471,8 @@ humidity-to-location map:
     DEBUG_PRINT(line);
     assert(line == "humidity-to-location map:");
     ParseMap(f, r.HumidityToLocation);
+
+    r.Compose();
   };
 }
 
@@ -204,24 +496,66 @@ int main(int argc, char** argv) {
 
   {
     aoc::AutoTimer t2{ "Part 1"};
-    for (const auto seed : r.Seeds) {
-      const auto location = r.GetSeedLocation(seed);
+    std::vector<int64_t> locations(r.Seeds.size());
+    r.LocateBatch(r.Seeds, locations);
+    for (const auto location : locations) {
       part1 = std::min(part1, location);
     }
   }
+  // part 2 runs the ranges forward through the maps, or with --reverse 1 searches
+  // back from the lowest locations
+  const bool reverse = aoc::get_int_option(argc, argv, "--reverse", 0);
+  Ranges seed_ranges;
+  for (size_t i = 0; i < r.Seeds.size(); i += 2) {
+    seed_ranges.emplace_back(r.Seeds[i], r.Seeds[i + 1]);
+  }
   int64_t part2 = INT64_MAX;
-  {
+  if (reverse) {
+    aoc::AutoTimer t3{ "Part 2 (reverse)" };
+    part2 = ReverseAlmanac(r).FindLowestLocation(seed_ranges);
+  } else {
     aoc::AutoTimer t3{ "Part 2" };
+    const auto locations = r.GetLocationRanges(seed_ranges);
+    if (!locations.empty()) {
+      part2 = locations.front().start;
+    }
+  }
+  aoc::print_results(part1, part2);
+
+  if (inTest) {
+    // check the range propagation and lookups against the per-seed walk
+    std::vector<int64_t> seeds;
     for (size_t i = 0; i < r.Seeds.size(); i += 2) {
       Range s(r.Seeds[i], r.Seeds[i + 1]);
       for (auto j = s.start; j <= s.end; j++) {
-        part2 = std::min(part2, r.GetSeedLocation(j));
+        seeds.push_back(j);
       }
     }
-  }
-  aoc::print_results(part1, part2);
+    // one thread takes whole wide blocks and a tail, four take only tails
+    std::vector<int64_t> locations(seeds.size());
+    std::vector<int64_t> split_locations(seeds.size());
+    r.LocateBatch(seeds, locations, 1);
+    r.LocateBatch(seeds, split_locations, 4);
+
+    std::vector<int64_t> walked;
+    std::vector<int64_t> looked_up;
+    for (const auto seed : seeds) {
+      walked.push_back(r.GetSeedLocation(seed));
+      looked_up.push_back(r.Locate(seed));
+    }
+    aoc::assert_results(looked_up, walked);
+    aoc::assert_results(locations, walked);
+    aoc::assert_results(split_locations, walked);
+    const auto oracle = *std::min_element(walked.begin(), walked.end());
+    aoc::assert_result(part2, oracle);
+    aoc::assert_result(ReverseAlmanac(r).FindLowestLocation(seed_ranges), oracle);
+
+    Almanac r2;
+    LoadInput(SampleInput2, r2);
+    const Ranges seed_ranges2{ Range(r2.Seeds[0], r2.Seeds[1]) };
+    aoc::assert_result(r2.GetLocationRanges(seed_ranges2).front().start, SR_Part2_2);
+    aoc::assert_result(ReverseAlmanac(r2).FindLowestLocation(seed_ranges2), SR_Part2_2);
 
-  if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
   }
@@ -1,6 +1,13 @@
 #include "aoc/helpers.h"
+#include "aoc/cpu.h"
 
+#include <array>
 #include <cmath>
+#include <span>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace {
   using Result = std::pair<int, int>;
@@ -11,11 +18,16 @@ Distance:  9  40  200)");
   constexpr int64_t SR_Part1 = 288;
   constexpr int64_t SR_Part2 = 71503;
 
+  // a time past 32 bits must load whole
+  constexpr std::string_view SampleInputLong(R"(Time:      3000000000
+Distance:  1)");
+  constexpr int64_t SR_Long = 2999999999;
+
   struct RaceRecord {
     int64_t time;
     int64_t distance{0};
 
-    RaceRecord(int t) : time(t) { }
+    RaceRecord(int64_t t) : time(t) { }
   };
 
   using RaceRecords = std::vector<RaceRecord>;
@@ -53,23 +65,135 @@ Distance:  9  40  200)");
     return r;
   };
 
-  // Solve for a * x^2 + b * x + c = 0
-  const auto SolveQuadtraic = [](double a, double b, double c) -> std::pair<double, double> {
-    const auto d = (b * b - 4.0 * a * c);
-    assert(d >= 0.0);
-    const auto sqrt_d = std::sqrt(d);
-    const auto x1 = (-b + sqrt_d) / (2.0 * a);
-    const auto x2 = (-b - sqrt_d) / (2.0 * a);
-    return {std::ceil(x1), std::ceil(x2)};
-  };
+  using Wide = __int128;
+
+  // floor(sqrt(n)), seeded from a long double estimate and then fixed up exactly
+  Wide ISqrt(Wide n) {
+    if (n < 2) {
+      return n;
+    }
+    Wide x = static_cast<Wide>(std::sqrt(static_cast<long double>(n)));
+    while (x * x > n) {
+      x--;
+    }
+    while ((x + 1) * (x + 1) <= n) {
+      x++;
+    }
+    return x;
+  }
+
+  // Times up to 2^63 keep time^2 inside 128 bits
+  constexpr Wide MaxTime = static_cast<Wide>(1) << 63;
 
-  const auto CountWaysToWin = [](const auto &rr) {
-    const auto res = SolveQuadtraic(-1, rr.time, -rr.distance);
-    const auto start = res.first;
-    const auto end = res.second;
-    return end - start;
+  // Holding for h wins when h * (time - h) > distance.  The first winning h is found
+  // from the integer square root of the discriminant, then nudged to the exact
+  // boundary; the winning holds are symmetric about time / 2.
+  const auto CountWaysToWin = [](Wide time, Wide distance) -> Wide {
+    assert(time < MaxTime);
+    const Wide disc = time * time - 4 * distance;
+    if (disc <= 0) {
+      return 0;
+    }
+    // the best hold is time / 2, so there are no wins if that does not win
+    const Wide half = time / 2;
+    Wide lo = (time - ISqrt(disc)) / 2;
+    while (lo <= half && lo * (time - lo) <= distance) {
+      lo++;
+    }
+    if (lo > half) {
+      return 0;
+    }
+    while (lo > 0 && (lo - 1) * (time - lo + 1) > distance) {
+      lo--;
+    }
+    return time - 2 * lo + 1;
   };
 
+  // Races with times below 2^26 and distances below 2^50 have a discriminant, and
+  // boundary products, that a double holds exactly; any longer distance cannot be
+  // beaten in such a short race, but takes the exact path all the same
+  constexpr int64_t MaxBatchTime = int64_t{1} << 26;
+  constexpr int64_t MaxBatchDistance = MaxBatchTime * MaxBatchTime / 4;
+
+  bool InBatchRange(int64_t time, int64_t distance) {
+    return time < MaxBatchTime && distance < MaxBatchDistance;
+  }
+
+  // A short race from a double square root and a fixed number of branch-free
+  // nudges to the exact boundary
+  int64_t CountWaysToWinShort(int64_t time, int64_t distance) {
+    const int64_t t = std::min(time, MaxBatchTime);
+    const int64_t d = std::min(distance, MaxBatchDistance);
+    const int64_t disc = t * t - 4 * d;
+    int64_t lo = (t - static_cast<int64_t>(std::sqrt(static_cast<double>(std::max<int64_t>(disc, 0))))) / 2;
+    lo += (lo * (t - lo) <= d);
+    lo += (lo * (t - lo) <= d);
+    lo -= ((lo - 1) * (t - lo + 1) > d);
+    lo -= ((lo - 1) * (t - lo + 1) > d);
+    return (disc > 0) * std::max<int64_t>(t - 2 * lo + 1, 0);
+  }
+
+#if defined(__x86_64__)
+  // CountWaysToWinShort four races at a time, in doubles throughout since every
+  // value in the batch range is an integer below 2^53; returns how many it did
+  __attribute__((target("avx2")))
+  size_t CountWaysToWinShortAVX2(const int64_t* times, const int64_t* distances, int64_t* out, size_t count) {
+    const __m256d one = _mm256_set1_pd(1);
+    const __m256d two = _mm256_set1_pd(2);
+    const __m256d four = _mm256_set1_pd(4);
+    const __m256d zero = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+      double tl[4];
+      double dl[4];
+      for (size_t l = 0; l < 4; l++) {
+        tl[l] = static_cast<double>(std::min(times[i + l], MaxBatchTime));
+        dl[l] = static_cast<double>(std::min(distances[i + l], MaxBatchDistance));
+      }
+      const __m256d t = _mm256_loadu_pd(tl);
+      const __m256d d = _mm256_loadu_pd(dl);
+      const __m256d disc = _mm256_sub_pd(_mm256_mul_pd(t, t), _mm256_mul_pd(four, d));
+      const __m256d root = _mm256_floor_pd(_mm256_sqrt_pd(_mm256_max_pd(disc, zero)));
+      __m256d lo = _mm256_floor_pd(_mm256_div_pd(_mm256_sub_pd(t, root), two));
+      for (int n = 0; n < 2; n++) {
+        const __m256d lost = _mm256_cmp_pd(_mm256_mul_pd(lo, _mm256_sub_pd(t, lo)), d, _CMP_LE_OQ);
+        lo = _mm256_add_pd(lo, _mm256_and_pd(lost, one));
+      }
+      for (int n = 0; n < 2; n++) {
+        const __m256d prev = _mm256_sub_pd(lo, one);
+        const __m256d won = _mm256_cmp_pd(_mm256_mul_pd(prev, _mm256_sub_pd(t, prev)), d, _CMP_GT_OQ);
+        lo = _mm256_sub_pd(lo, _mm256_and_pd(won, one));
+      }
+      __m256d ways = _mm256_max_pd(_mm256_add_pd(_mm256_sub_pd(t, _mm256_mul_pd(two, lo)), one), zero);
+      ways = _mm256_and_pd(ways, _mm256_cmp_pd(disc, zero, _CMP_GT_OQ));
+      // below 2^27, so the narrowing conversion is exact
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(ways)));
+    }
+    return i;
+  }
+#endif
+
+  // Count many races at once: short races go four at a time through the vector
+  // kernel, longer races take the exact path
+  void CountWaysToWinBatch(std::span<const int64_t> times, std::span<const int64_t> distances, std::span<int64_t> out) {
+    assert(times.size() == distances.size() && times.size() == out.size());
+    size_t i = 0;
+#if defined(__x86_64__)
+    if (aoc::has_avx2()) {
+      i = CountWaysToWinShortAVX2(times.data(), distances.data(), out.data(), times.size());
+    }
+#endif
+    for (; i < times.size(); i++) {
+      out[i] = CountWaysToWinShort(times[i], distances[i]);
+    }
+    for (size_t i = 0; i < times.size(); i++) {
+      if (!InBatchRange(times[i], distances[i])) {
+        out[i] = CountWaysToWin(times[i], distances[i]);
+      }
+    }
+  }
+
   const auto CountWaysToWinSimple = [](const auto &rr) {
     // for each ms we hold the button, the speed will increase by 1 ms per ms
     // holding the button down counts towards race time
@@ -125,10 +249,17 @@ int main(int argc, char** argv) {
   int64_t part2 = 0;
 
   // Part 1, count the ways to win for each race and multiply them together
+  std::vector<int64_t> ways(r.size());
   {
     aoc::AutoTimer t{"Part 1"};
+    std::vector<int64_t> times;
+    std::vector<int64_t> distances;
     for (const auto &rr : r) {
-      const auto ways_to_win = CountWaysToWinSimple(rr);
+      times.push_back(rr.time);
+      distances.push_back(rr.distance);
+    }
+    CountWaysToWinBatch(times, distances, ways);
+    for (const auto ways_to_win : ways) {
       if (!part1) { part1 = ways_to_win; }
       else { part1 *= ways_to_win; }
     }
@@ -137,14 +268,30 @@ int main(int argc, char** argv) {
   // Part 2, the input had bad kerning, and its one race, so combine the numbers
   {
     aoc::AutoTimer t{"Part 2"};
-    RaceRecord rr{0};
+    // keep both below 2^124, so time^2 and 4 * distance fit in CountWaysToWin
+    const auto kern = [](Wide v, int64_t n) {
+      constexpr Wide limit = MaxTime * MaxTime / 4;
+      for (int w = CountDigits(n); w > 0; w--) {
+        if (v > limit / 10) {
+          throw std::runtime_error("Race record too wide");
+        }
+        v *= 10;
+      }
+      if (v > limit - 1 - n) {
+        throw std::runtime_error("Race record too wide");
+      }
+      return v + n;
+    };
+    Wide time = 0;
+    Wide distance = 0;
     for (const auto &i : r) {
-      const auto time_width = CountDigits(i.time);
-      const auto distance_width  = CountDigits(i.distance);
-      rr.time = rr.time * std::pow(10, time_width) + i.time;
-      rr.distance = rr.distance * std::pow(10, distance_width) + i.distance;
+      time = kern(time, i.time);
+      distance = kern(distance, i.distance);
+    }
+    if (time >= MaxTime) {
+      throw std::runtime_error("Race record too wide");
     }
-    part2 = CountWaysToWin(rr);
+    part2 = CountWaysToWin(time, distance);
   }
 
   aoc::print_results(part1, part2);
@@ -152,6 +299,47 @@ int main(int argc, char** argv) {
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+
+    for (size_t i = 0; i < r.size(); i++) {
+      aoc::assert_result(ways[i], CountWaysToWinSimple(r[i]));
+    }
+
+    const auto long_race = LoadInput(SampleInputLong);
+    aoc::assert_result(long_race[0].time, 3000000000);
+    aoc::assert_result(static_cast<int64_t>(CountWaysToWin(long_race[0].time, long_race[0].distance)), SR_Long);
+
+    // distances past the batch range must take the exact path, not overflow
+    const std::array<int64_t, 3> times{ 10, 1 << 20, 3000000000 };
+    const std::array<int64_t, 3> distances{ 3000000000000000000, 1, INT64_MAX };
+    std::array<int64_t, 3> batch;
+    CountWaysToWinBatch(times, distances, batch);
+    for (size_t i = 0; i < times.size(); i++) {
+      aoc::assert_result(batch[i], static_cast<int64_t>(CountWaysToWin(times[i], distances[i])));
+    }
+
+    // short races with distances on and either side of the ones the best and a
+    // poorer hold just reach, and one more so the last is not in a whole vector
+    std::vector<int64_t> short_times;
+    std::vector<int64_t> short_distances;
+    for (const int64_t base : { int64_t{0}, MaxBatchTime - 40 }) {
+      for (int64_t t = base + 1; t < base + 40; t++) {
+        for (const auto h : { t / 2, t / 3 }) {
+          for (const auto d : { h * (t - h) - 1, h * (t - h), h * (t - h) + 1 }) {
+            short_times.push_back(t);
+            short_distances.push_back(std::max<int64_t>(d, 0));
+          }
+        }
+      }
+    }
+    short_times.push_back(MaxBatchTime - 1);
+    short_distances.push_back(0);
+    std::vector<int64_t> short_batch(short_times.size());
+    std::vector<int64_t> exact;
+    CountWaysToWinBatch(short_times, short_distances, short_batch);
+    for (size_t i = 0; i < short_times.size(); i++) {
+      exact.push_back(static_cast<int64_t>(CountWaysToWin(short_times[i], short_distances[i])));
+    }
+    aoc::assert_results(short_batch, exact);
   }
 
   return 0;
@@ -1,11 +1,10 @@
 #include "aoc/helpers.h"
 
 #include <array>
-#include <map>
-#include <set>
+#include <stdexcept>
 
 namespace {
-  using Result = std::pair<int, int>;
+  using Result = std::pair<int64_t, int64_t>;
   using MappedFileSource = aoc::MappedFileSource<char>;
 
   constexpr std::string_view SampleInput(R"(32T3K 765
@@ -15,26 +14,7 @@ KTJJT 220
 QQQJA 483)");
   constexpr int SR_Part1 = 6440;
   constexpr int SR_Part2 = 5905;
-
-  const auto GetCardValue = [](char c, bool joker) -> int {
-    switch(c) {
-      case 'A': return 12;
-      case 'K': return 11; 
-      case 'Q': return 10;
-      case 'J': return (joker) ? -1 : 9;
-      case 'T': return 8;
-      case '9': return 7;
-      case '8': return 6; 
-      case '7': return 5;
-      case '6': return 4;
-      case '5': return 3;
-      case '4': return 2;
-      case '3': return 1;
-      case '2': return 0;
-      default: break;
-    }
-    throw std::runtime_error("Invalid card");
-  };
+  constexpr std::string_view SR_InvalidError("Invalid card");
 
   enum class HandType {
     Unranked,
@@ -49,148 +29,197 @@ QQQJA 483)");
 
   using Hand = std::string_view;
 
-  struct RankedHand {
-    Hand hand;
-    int64_t bid;
-    HandType type;
-
-    RankedHand(Hand h, int64_t b, HandType t) : hand(h), bid(b), type(t) { }
+  // Card ranks 0..12, without and with jokers (which then rank lowest), with
+  // ValidCard set for every byte that is a card
+  struct CardRanks {
+    static constexpr uint8_t ValidCard = 0x10;
+    static constexpr uint8_t RankMask = 0x0f;
+
+    uint8_t plain[256];
+    uint8_t joker[256];
+
+    constexpr CardRanks()
+      : plain()
+      , joker() {
+        constexpr std::string_view plain_order{"23456789TJQKA"};
+        constexpr std::string_view joker_order{"J23456789TQKA"};
+        for (size_t i = 0; i < plain_order.size(); i++) {
+          plain[static_cast<uint8_t>(plain_order[i])] = i | ValidCard;
+          joker[static_cast<uint8_t>(joker_order[i])] = i | ValidCard;
+        }
+      }
   };
 
-  using CardCounts = std::map<char, uint_fast8_t>;
-  using CardGroups = std::vector<uint_fast8_t>;
+  constexpr CardRanks CARD_RANKS;
+
+  // A hand packed into one sortable key: the type above five 4-bit card ranks
+  using HandKey = uint32_t;
+  constexpr int HandTypeShift = 20;
 
-  const auto GetCardCounts = [](const std::string_view h) {
-    CardCounts counts;
+  template<bool Joker>
+  HandKey EncodeHand(const Hand& h) {
+    assert(h.size() == 5);
+    uint8_t counts[13]{};
+    HandKey key = 0;
+    int jokers = 0;
+    uint8_t valid = CardRanks::ValidCard;
     for (const auto c : h) {
-      auto it = counts.emplace(c, 0);
-      it.first->second++;
+      const auto entry = Joker ? CARD_RANKS.joker[static_cast<uint8_t>(c)] : CARD_RANKS.plain[static_cast<uint8_t>(c)];
+      valid &= entry;
+      const auto rank = entry & CardRanks::RankMask;
+      key = (key << 4) | rank;
+      if (Joker && c == 'J') {
+        jokers++;
+      } else {
+        counts[rank]++;
+      }
     }
-    return counts;
-  };
 
-  const auto GroupCardCountsFromCounts = [](const CardCounts& counts) {
-    CardGroups groups;
-    groups.reserve(counts.size());
-    for (const auto& [c, count] : counts) {
-      (void)c;
-      groups.push_back(count);
+    if (!valid) {
+      throw std::runtime_error("Invalid card");
     }
 
-    std::sort(groups.begin(), groups.end(), std::greater<uint_fast8_t>());
+    // the type only depends on how many distinct cards there are and the largest group,
+    // which the jokers join
+    int distinct = 0;
+    int most = 0;
+    for (const auto n : counts) {
+      distinct += (n > 0);
+      most = std::max<int>(most, n);
+    }
+    distinct = std::max(distinct, 1);
+    most += jokers;
+
+    HandType type = HandType::Unranked;
+    switch (distinct) {
+      case 1: type = HandType::FiveOfAKind; break;
+      case 2: type = (most == 4) ? HandType::FourOfAKind : HandType::FullHouse; break;
+      case 3: type = (most == 3) ? HandType::ThreeOfAKind : HandType::TwoPair; break;
+      case 4: type = HandType::OnePair; break;
+      case 5: type = HandType::HighCard; break;
+    }
+    return (static_cast<HandKey>(type) << HandTypeShift) | key;
+  }
 
-    return groups;
-  };
+  // Hands are ranked as (key << 32 | bid), so sorting the keys carries the bids along
+  using RankedHands = std::vector<uint64_t>;
 
-  const auto GroupCardCounts = [](const auto& h) {
-    const auto counts = GetCardCounts(h);
-    return GroupCardCountsFromCounts(counts);
+  const auto RankHand = [](HandKey key, int64_t bid) -> uint64_t {
+    assert(bid >= 0 && bid <= UINT32_MAX);
+    return (static_cast<uint64_t>(key) << 32) | static_cast<uint64_t>(bid);
   };
 
-  const auto GetHandRankFromGroups = [](const CardGroups& g) {
-    switch (g.size()) {
-      case 1:
-        return HandType::FiveOfAKind;
-      case 2:
-        // Either 4 of a kind or a full house
-        if (g[0] == 4) {
-          return HandType::FourOfAKind;
-        }
-        return HandType::FullHouse;
-      case 3:
-        // Either 3 of a kind or a two pair
-        if (g[0] == 3) {
-          return HandType::ThreeOfAKind;
-        }
-        return HandType::TwoPair;
-      case 4:
-        return HandType::OnePair;
-      case 5:
-        return HandType::HighCard;
+  // LSD radix sort on the 24 key bits, a byte at a time
+  void SortHands(RankedHands& v) {
+    RankedHands tmp(v.size());
+    for (int shift = 32; shift < 56; shift += 8) {
+      std::array<size_t, 257> offsets{};
+      for (const auto h : v) {
+        offsets[((h >> shift) & 0xff) + 1]++;
+      }
+      for (size_t i = 1; i < offsets.size(); i++) {
+        offsets[i] += offsets[i - 1];
+      }
+      for (const auto h : v) {
+        tmp[offsets[(h >> shift) & 0xff]++] = h;
+      }
+      v.swap(tmp);
     }
-    throw std::runtime_error("Invalid hand");
-  };
-
-  const auto GetHandRank = [](const Hand& h) {
-    const auto groups = GroupCardCounts(h);
-    return GetHandRankFromGroups(groups);
-  };
+  }
 
-  const auto GetHandRankJoker = [](const Hand& h) {
-    // remove jokers
-    std::array<char, 5> cards;
-    size_t i = 0;
-    std::for_each(h.begin(), h.end(), [&cards, &i](const char c) { if (c != 'J') { cards[i++] = c; } });
-    const auto num_jokers = h.size() - i;
-    if (num_jokers == 0) {
-      return GetHandRank(h);
-    }
-    auto groups = GroupCardCounts(std::string_view{cards.data(), i});
-    if (groups.empty()) {
-      groups.push_back(0);
+  const auto ScoreGames = [](RankedHands& games) {
+    SortHands(games);
+    int64_t score = 0;
+    for (size_t i = 0; i < games.size(); i++) {
+      const auto bid = static_cast<int64_t>(games[i] & UINT32_MAX);
+      DEBUG_PRINT("Rank: " << i + 1 << " Key: " << (games[i] >> 32) << " Bid: " << bid);
+      score += static_cast<int64_t>(i + 1) * bid;
     }
-    groups[0] += num_jokers;
-    return GetHandRankFromGroups(groups);
+    return score;
   };
 
-  const auto RankHand = [](const Hand& h, int64_t bid) {
-    return RankedHand(h, bid, GetHandRank(h));
-  };
+  const auto LoadInput = [](auto f) {
+    RankedHands g1;
+    RankedHands g2;
+    std::string_view line;
+    while (aoc::getline(f, line)) {
+      const auto idx = line.find(' ');
+      const auto h = line.substr(0, idx);
+      const auto bid = aoc::stoi(line.substr(idx + 1));
+      g1.push_back(RankHand(EncodeHand<false>(h), bid));
+      g2.push_back(RankHand(EncodeHand<true>(h), bid));
+    }
 
-  const auto RankHandJoker = [](const Hand& h, int64_t bid) {
-    return RankedHand(h, bid, GetHandRankJoker(h));
+    return std::make_pair(ScoreGames(g1), ScoreGames(g2));
   };
 
-  const auto HandComparatorImpl = [](const RankedHand& lhs, const RankedHand& rhs, bool joker) {
-    if ( rhs.type != lhs.type) {
-      return rhs.type < lhs.type;
-    }
-
-    // tie breaker
-    for (size_t i = 0; i < rhs.hand.size(); ++i) {
-      if (rhs.hand[i] == lhs.hand[i]) {
-        continue;
+  // Total winnings kept up to date as hands arrive.  A new hand ranks above every
+  // hand with a key no greater than its own, and pushes each hand above it up by
+  // one, adding that hand's bid again; Fenwick trees over the key space give the
+  // count and bid sum below a key in O(log n).
+  class OnlineRanking {
+    // keys compressed to type * 13^5 + the card ranks in base 13
+    static constexpr size_t KeySpace = 8 * 13 * 13 * 13 * 13 * 13;
+
+    std::vector<int32_t> counts;
+    std::vector<int64_t> bids;
+    int64_t bid_total = 0;
+    int64_t winnings = 0;
+
+    static size_t Compress(HandKey key) {
+      size_t idx = key >> HandTypeShift;
+      for (int shift = HandTypeShift - 4; shift >= 0; shift -= 4) {
+        idx = idx * 13 + ((key >> shift) & 0xf);
       }
-      return GetCardValue(rhs.hand[i], joker) < GetCardValue(lhs.hand[i], joker);
+      return idx;
     }
 
-    throw std::runtime_error("Invalid hand");
-  };
-  const auto HandComparatorJoker = [](const RankedHand& lhs, const RankedHand& rhs) {
-    return HandComparatorImpl(lhs, rhs, true);
-  };
-  const auto HandComparator = [](const RankedHand& lhs, const RankedHand& rhs) {
-    return HandComparatorImpl(lhs, rhs, false);
-  };
+  public:
+    OnlineRanking()
+      : counts(KeySpace + 1, 0)
+      , bids(KeySpace + 1, 0)
+    { }
+
+    // Add a hand and return the total winnings including it
+    int64_t Add(HandKey key, int64_t bid) {
+      const auto idx = Compress(key) + 1;
+
+      // hands with keys up to and including this one
+      int64_t below = 0;
+      int64_t below_bids = 0;
+      for (auto i = idx; i > 0; i -= i & -i) {
+        below += counts[i];
+        below_bids += bids[i];
+      }
+      winnings += bid * (below + 1) + (bid_total - below_bids);
 
-  using Part1Games = std::set<RankedHand, decltype(HandComparator)>;
-  using Part2Games = std::set<RankedHand, decltype(HandComparatorJoker)>;
+      for (auto i = idx; i <= KeySpace; i += i & -i) {
+        counts[i]++;
+        bids[i] += bid;
+      }
+      bid_total += bid;
+      return winnings;
+    }
 
-  const auto ScoreGames = [](const auto& games) {
-    int64_t i = 0;
-    int64_t score = 0;
-    for (auto it = games.rbegin(); it != games.rend(); ++it) {
-      const auto bid = it->bid;
-      DEBUG_PRINT("Rank: " << i << " Hand: " << it->hand << " Type: " << (int)it->type << " Bid: " << bid);
-      score += ++i * bid;
+    int64_t Winnings() const {
+      return winnings;
     }
-    return score;
   };
 
-  const auto LoadInput = [](auto f) {
-    Part1Games g1(HandComparator);
-    Part2Games g2(HandComparatorJoker);
+  // Calls op(part1, part2) with the winnings so far after every hand
+  template<typename Op>
+  Result LoadInputOnline(std::string_view f, Op op) {
+    std::unique_ptr<OnlineRanking> g1(new OnlineRanking());
+    std::unique_ptr<OnlineRanking> g2(new OnlineRanking());
     std::string_view line;
     while (aoc::getline(f, line)) {
       const auto idx = line.find(' ');
       const auto h = line.substr(0, idx);
       const auto bid = aoc::stoi(line.substr(idx + 1));
-      g1.emplace(RankHand(h, bid));
-      g2.emplace(RankHandJoker(h, bid));
+      op(g1->Add(EncodeHand<false>(h), bid), g2->Add(EncodeHand<true>(h), bid));
     }
-
-    return std::make_pair(ScoreGames(g1), ScoreGames(g2));    
-  };
+    return { g1->Winnings(), g2->Winnings() };
+  }
 }
 
 int main(int argc, char** argv) {
@@ -203,11 +232,17 @@ int main(int argc, char** argv) {
   } else {
     std::unique_ptr<MappedFileSource>m(new MappedFileSource(argc, argv));
     std::string_view f(m->data(), m->size());
-    r = LoadInput(f);
+    if (aoc::get_int_option(argc, argv, "--online", 0)) {
+      r = LoadInputOnline(f, [](int64_t w1, int64_t w2) {
+        std::cout << w1 << " " << w2 << std::endl;
+      });
+    } else {
+      r = LoadInput(f);
+    }
   }
 
-  int part1 = 0;
-  int part2 = 0;
+  int64_t part1 = 0;
+  int64_t part2 = 0;
 
   std::tie(part1, part2) = r;
 
@@ -216,6 +251,24 @@ int main(int argc, char** argv) {
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+
+    // after each hand the online totals must match ranking that prefix from scratch
+    std::string_view prefix(SampleInput.data(), 0);
+    const auto online = LoadInputOnline(SampleInput, [&prefix](int64_t w1, int64_t w2) {
+      const auto end = SampleInput.find('\n', prefix.size() + 1);
+      prefix = SampleInput.substr(0, end);
+      const auto expected = LoadInput(prefix);
+      aoc::assert_result(Result(w1, w2), expected);
+    });
+    aoc::assert_result(online, r);
+
+    std::string error;
+    try {
+      LoadInput(std::string_view("32T3X 765"));
+    } catch (const std::runtime_error& e) {
+      error = e.what();
+    }
+    aoc::assert_result(error, SR_InvalidError);
   }
 
   return 0;
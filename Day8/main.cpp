@@ -1,6 +1,10 @@
 #include "aoc/helpers.h"
+#include "aoc/parallel.h"
 
-#include <map>
+#include <array>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
 
 namespace {
   using Result = std::pair<int, int>;
@@ -20,65 +24,398 @@ ZZZ = (ZZZ, ZZZ))");
 22B = (22C, 22C)
 22C = (22Z, 22Z)
 22Z = (22B, 22B)
+XXX = (XXX, XXX))");
+
+  // the ghosts first align at 4, but the lcm of their first arrivals is 2
+  constexpr std::string_view SampleInput3(R"(L
+
+11A = (11B, XXX)
+11B = (11Z, XXX)
+11Z = (11B, XXX)
+22A = (22Z, XXX)
+22Z = (22B, XXX)
+22B = (22C, XXX)
+22C = (22Z, XXX)
 XXX = (XXX, XXX))");
 
   constexpr int SR_Part1 = 6;
   constexpr int SR_Part2 = 6;
+  constexpr int64_t SR_Wide = 123456789;
+  constexpr std::string_view SR_WideError("Ghosts do not align within an int64 step count");
+  constexpr std::string_view SR_NeverError("Ghosts never align");
+  constexpr int SR_Part2_3 = 4;
+  constexpr int64_t SR_Many = 987654321987;
+
+  // Node names are three characters of 5 bits each: 'A'-'Z' are 0-25, and '0'-'5'
+  // take the spare codes (the examples use digits)
+  struct NodeCodes {
+    uint8_t code[256];
+    bool valid[256];
 
-  struct Node {
-    struct Node *L{nullptr};
-    struct Node *R{nullptr};
-    bool is_end{false};
-    bool is_terminal{false};
+    constexpr NodeCodes()
+      : code()
+      , valid() {
+        for (int c = 'A'; c <= 'Z'; c++) {
+          code[c] = c - 'A';
+          valid[c] = true;
+        }
+        for (int c = '0'; c <= '5'; c++) {
+          code[c] = 26 + c - '0';
+          valid[c] = true;
+        }
+      }
   };
 
-  using NodeMap = std::map<std::string, Node>;
+  constexpr NodeCodes NODE_CODES;
+
+  using NodeId = uint16_t;
+  constexpr size_t NodeSpace = 1 << 15;
+
+  NodeId EncodeNode(const char* n) {
+    NodeId id = 0;
+    for (size_t i = 0; i < 3; i++) {
+      const auto c = static_cast<uint8_t>(n[i]);
+      if (!NODE_CODES.valid[c]) {
+        throw std::runtime_error("Invalid node name");
+      }
+      id = (id << 5) | NODE_CODES.code[c];
+    }
+    return id;
+  }
+
+  constexpr bool IsSource(NodeId n) {
+    return (n & 31) == NODE_CODES.code[static_cast<uint8_t>('A')];
+  }
+
+  constexpr bool IsTerminal(NodeId n) {
+    return (n & 31) == NODE_CODES.code[static_cast<uint8_t>('Z')];
+  }
 
   struct Input {
-    std::string pattern;
-    NodeMap map;
-    Node *start{nullptr};
-    std::vector<Node *>sources;
+    // one bit per instruction, set for 'R'
+    std::vector<uint64_t> pattern;
+    size_t pattern_size{0};
+    // children indexed by [instruction bit][node]
+    std::array<std::vector<NodeId>, 2> next;
+    std::vector<NodeId> nodes;
+    std::vector<NodeId> sources;
+    bool has_start{false};
+
+    bool Direction(size_t i) const {
+      return (pattern[i >> 6] >> (i & 63)) & 1;
+    }
+
+    // Follow the instructions from p until done(node), returning the steps taken
+    template<typename Done>
+    int64_t Walk(NodeId p, Done done) const {
+      const NodeId* children[2] = { next[0].data(), next[1].data() };
+      int64_t d = 0;
+      size_t i = 0;
+      while (!done(p)) {
+        p = children[Direction(i)][p];
+        d++;
+        if (++i == pattern_size) {
+          i = 0;
+        }
+      }
+      return d;
+    }
+
+    // Follow one whole pattern from n, appending the offsets within it at which a
+    // terminal node is visited, and return the node it ends on
+    NodeId JumpPattern(NodeId n, std::vector<int64_t>& hits) const {
+      for (size_t i = 0; i < pattern_size; i++) {
+        if (IsTerminal(n)) {
+          hits.push_back(i);
+        }
+        n = next[Direction(i)][n];
+      }
+      return n;
+    }
   };
-  
+
+  // Where a whole pattern takes each node, and the terminal hits along the way; at
+  // pattern boundaries a ghost's state is just its node
+  struct PatternJumps {
+    std::vector<NodeId> next;
+    std::vector<std::vector<int64_t>> hits;
+
+    // Each node's entry is written by exactly one thread
+    PatternJumps(const Input& r, size_t threads)
+      : next(NodeSpace, 0)
+      , hits(NodeSpace)
+    {
+      aoc::parallel_for(r.nodes.size(), threads, [this, &r](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          const auto n = r.nodes[i];
+          next[n] = r.JumpPattern(n, hits[n]);
+        }
+      });
+    }
+  };
+
+  using Wide = __int128;
+
+  // The steps at which a ghost is on a terminal node: a finite set before its cycle
+  // starts, then the cycle's hits repeating every period steps
+  struct GhostCycle {
+    int64_t tail{0};
+    int64_t period{0};
+    std::vector<int64_t> tail_hits;
+    // offsets from tail, within [0, period)
+    std::vector<int64_t> cycle_hits;
+
+    bool HitAt(int64_t t) const {
+      if (t < tail) {
+        return std::find(tail_hits.begin(), tail_hits.end(), t) != tail_hits.end();
+      }
+      const auto offset = (t - tail) % period;
+      return std::find(cycle_hits.begin(), cycle_hits.end(), offset) != cycle_hits.end();
+    }
+  };
+
+  GhostCycle AnalyseGhost(const Input& r, const PatternJumps& jumps, NodeId start) {
+    const int64_t p = r.pattern_size;
+
+    // find the first repeated node at a pattern boundary
+    std::vector<NodeId> blocks;
+    std::vector<int32_t> seen(NodeSpace, -1);
+    NodeId n = start;
+    while (seen[n] < 0) {
+      seen[n] = blocks.size();
+      blocks.push_back(n);
+      n = jumps.next[n];
+    }
+
+    GhostCycle g;
+    const int64_t mu = seen[n];
+    g.tail = mu * p;
+    g.period = (static_cast<int64_t>(blocks.size()) - mu) * p;
+    for (int64_t b = 0; b < static_cast<int64_t>(blocks.size()); b++) {
+      for (const auto o : jumps.hits[blocks[b]]) {
+        if (b < mu) {
+          g.tail_hits.push_back(b * p + o);
+        } else {
+          g.cycle_hits.push_back((b - mu) * p + o);
+        }
+      }
+    }
+    DEBUG_PRINT("Ghost tail: " << g.tail << " period: " << g.period << " hits: " << g.tail_hits.size() << "+" << g.cycle_hits.size());
+    return g;
+  }
+
+  Wide MulChecked(Wide a, Wide b) {
+    Wide r;
+    if (__builtin_mul_overflow(a, b, &r)) {
+      throw std::overflow_error("Ghost congruence overflows 128 bits");
+    }
+    return r;
+  }
+
+  // Combine x = a1 (mod m1) with x = a2 (mod m2), moduli need not be coprime
+  std::optional<std::pair<Wide, Wide>> CombineCongruences(Wide a1, Wide m1, Wide a2, Wide m2) {
+    // extended gcd: m1 * u + m2 * v = g
+    Wide old_r = m1, r = m2, old_u = 1, u = 0;
+    while (r) {
+      const auto q = old_r / r;
+      std::tie(old_r, r) = std::make_pair(r, old_r - q * r);
+      std::tie(old_u, u) = std::make_pair(u, old_u - q * u);
+    }
+    const auto g = old_r;
+    if ((a2 - a1) % g) {
+      return std::nullopt;
+    }
+    const auto m2g = m2 / g;
+    const auto k = MulChecked(((a2 - a1) / g) % m2g, old_u % m2g) % m2g;
+    const auto lcm = MulChecked(m1, m2g);
+    return std::make_pair(((a1 + MulChecked(k, m1)) % lcm + lcm) % lcm, lcm);
+  }
+
+  // Most residues AlignGhosts keeps while combining congruences
+  constexpr size_t MaxResidues = size_t{1} << 16;
+
+  // The first step at which every ghost is on a terminal node
+  int64_t AlignGhosts(const std::vector<GhostCycle>& ghosts) {
+    if (ghosts.empty()) {
+      return 0;
+    }
+
+    // alignments before every ghost is cycling must be one of the first ghost's hits
+    int64_t tail = 0;
+    for (const auto& g : ghosts) {
+      tail = std::max(tail, g.tail);
+    }
+    const auto& g0 = ghosts.front();
+    const auto aligned = [&ghosts](int64_t t) {
+      return std::all_of(ghosts.begin(), ghosts.end(), [t](const auto& g) { return g.HitAt(t); });
+    };
+    for (const auto t : g0.tail_hits) {
+      if (t < tail && aligned(t)) {
+        return t;
+      }
+    }
+    for (int64_t base = g0.tail; base < tail; base += g0.period) {
+      for (const auto c : g0.cycle_hits) {
+        if (base + c < tail && aligned(base + c)) {
+          return base + c;
+        }
+      }
+    }
+
+    // Past that each ghost is periodic, so solve the congruences with the CRT.  Ghosts
+    // with the fewest hits go first to keep the candidate set small.  Once the
+    // combined modulus covers every step from tail to INT64_MAX each residue has at
+    // most one step left in range, and once there are MaxResidues residues another
+    // ghost would multiply them past what is worth holding; either way the steps
+    // left are cheaper to check against the remaining ghosts directly than to keep
+    // combining.
+    std::vector<const GhostCycle*> order;
+    for (const auto& g : ghosts) {
+      order.push_back(&g);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const auto* a, const auto* b) {
+      return a->cycle_hits.size() < b->cycle_hits.size();
+    });
+
+    const Wide range = static_cast<Wide>(INT64_MAX) - tail + 1;
+    std::vector<std::pair<Wide, Wide>> solutions{ { 0, 1 } };
+    size_t combined = 0;
+    for (; combined < order.size() && !solutions.empty(); combined++) {
+      const auto* g = order[combined];
+      // every solution shares the same modulus, the lcm of the periods so far
+      if (solutions.front().second >= range || solutions.size() * g->cycle_hits.size() > MaxResidues) {
+        break;
+      }
+      std::vector<std::pair<Wide, Wide>> next;
+      for (const auto& [a, m] : solutions) {
+        for (const auto c : g->cycle_hits) {
+          const auto s = CombineCongruences(a, m, (g->tail + c) % g->period, g->period);
+          if (s) {
+            next.push_back(*s);
+          }
+        }
+      }
+      std::sort(next.begin(), next.end());
+      next.erase(std::unique(next.begin(), next.end()), next.end());
+      solutions.swap(next);
+    }
+
+    if (solutions.empty()) {
+      throw std::runtime_error("Ghosts never align");
+    }
+    const auto rest_hit = [&order, combined](int64_t t) {
+      return std::all_of(order.begin() + combined, order.end(), [t](const auto* g) { return g->HitAt(t); });
+    };
+
+    const Wide m = solutions.front().second;
+    if (m < range) {
+      // Walk the steps the residues allow in increasing order.  Every ghost is back
+      // where it started after the lcm of the periods, so give up after that many.
+      Wide lcm = 1;
+      for (const auto& g : ghosts) {
+        lcm = lcm / std::gcd(static_cast<int64_t>(lcm % g.period), g.period) * g.period;
+        if (lcm >= range) {
+          break;
+        }
+      }
+      const Wide last = std::min(static_cast<Wide>(INT64_MAX), tail + lcm - 1);
+      for (Wide base = tail - tail % m; base <= last; base += m) {
+        for (const auto& [a, _] : solutions) {
+          const auto t = base + a;
+          if (t > last) {
+            break;
+          }
+          if (t >= tail && rest_hit(static_cast<int64_t>(t))) {
+            return static_cast<int64_t>(t);
+          }
+        }
+      }
+      if (lcm < range) {
+        throw std::runtime_error("Ghosts never align");
+      }
+      throw std::runtime_error("Ghosts do not align within an int64 step count");
+    }
+
+    Wide best = -1;
+    for (const auto& [a, _] : solutions) {
+      // the first t >= tail with t = a (mod m)
+      const auto t = a + (a < tail ? (tail - a + m - 1) / m * m : 0);
+      if (t > INT64_MAX || !rest_hit(static_cast<int64_t>(t))) {
+        continue;
+      }
+      if (best < 0 || t < best) {
+        best = t;
+      }
+    }
+    if (best < 0) {
+      throw std::runtime_error("Ghosts do not align within an int64 step count");
+    }
+    return static_cast<int64_t>(best);
+  }
+
+  // Ghosts on prime periods from `from` up, ghost i hitting at each offset in
+  // hits(i, period), used to exercise AlignGhosts with many coprime cycles
+  template<typename Hits>
+  std::vector<GhostCycle> PrimeGhosts(size_t count, Hits hits, int64_t from = 101) {
+    std::vector<GhostCycle> ghosts;
+    for (int64_t p = from; ghosts.size() < count; p++) {
+      bool prime = true;
+      for (int64_t d = 2; d * d <= p && prime; d++) {
+        prime = p % d;
+      }
+      if (prime) {
+        GhostCycle g;
+        g.period = p;
+        g.cycle_hits = hits(ghosts.size(), p);
+        ghosts.push_back(g);
+      }
+    }
+    return ghosts;
+  }
+
+  // Build the jump table, then analyse the ghosts, both spread over the threads; the
+  // ghosts only read the node and jump tables
+  const auto SolveGhosts = [](const Input& r, size_t threads) {
+    const PatternJumps jumps(r, threads);
+    std::vector<GhostCycle> ghosts(r.sources.size());
+    aoc::parallel_for(r.sources.size(), threads, [&r, &jumps, &ghosts](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        ghosts[i] = AnalyseGhost(r, jumps, r.sources[i]);
+      }
+    });
+    return AlignGhosts(ghosts);
+  };
+
   const auto LoadInput = [](auto f) {
     std::string_view line;
 
     // Pattern is the first line
     aoc::getline(f, line);
     Input r;
-    r.pattern = std::string{line.data(), line.size()};
+    r.pattern_size = line.size();
+    r.pattern.resize((line.size() + 63) / 64, 0);
+    for (size_t i = 0; i < line.size(); i++) {
+      r.pattern[i >> 6] |= static_cast<uint64_t>(line[i] == 'R') << (i & 63);
+    }
 
-    // Load the map
+    // Load the map, every line is "AAA = (BBB, CCC)"
+    constexpr size_t LeftOffset = sizeof("AAA = (") - 1;
+    constexpr size_t RightOffset = sizeof("AAA = (BBB, ") - 1;
+    r.next[0].resize(NodeSpace, 0);
+    r.next[1].resize(NodeSpace, 0);
     while (aoc::getline(f, line)) {
-      auto p = line.find(' ');
-      std::string_view source = line.substr(0, p);
-      line.remove_prefix(p + 1);
-      while (line.front() == ' ' || line.front() == '(' || line.front() == '=') { line.remove_prefix(1); }
-      p = line.find(',');
-      std::string_view left = line.substr(0, p);
-      line.remove_prefix(p + 1);
-      while (line.front() == ' ') { line.remove_prefix(1); }
-      p = line.find(')');
-      std::string_view right = line.substr(0, p);
-
-      // create, or locate the nodes in the map
-      auto sit = r.map.emplace(source, Node{});
-      auto lit = r.map.emplace(left, Node{});
-      auto rit = r.map.emplace(right, Node{});
-
-      auto *source_node = &sit.first->second;
-
-      source_node->L = &lit.first->second;
-      source_node->R = &rit.first->second;
-      if (source == "ZZZ") {
-        source_node->is_end = true;
-      } else if (source == "AAA") {
-        r.start = source_node;
-      }
-      source_node->is_terminal = source.back() == 'Z';
-      if (source.back() == 'A') {
-        r.sources.push_back(source_node);
+      if (line.size() < RightOffset + 3) {
+        throw std::runtime_error("Invalid node line");
+      }
+      const auto source = EncodeNode(line.data());
+      r.next[0][source] = EncodeNode(line.data() + LeftOffset);
+      r.next[1][source] = EncodeNode(line.data() + RightOffset);
+      r.nodes.push_back(source);
+      if (source == EncodeNode("AAA")) {
+        r.has_start = true;
+      }
+      if (IsSource(source)) {
+        r.sources.push_back(source);
       }
     }
     return r;
@@ -88,6 +425,7 @@ XXX = (XXX, XXX))");
 int main(int argc, char** argv) {
   aoc::AutoTimer t;
   const bool inTest = argc < 2;
+  const size_t threads = aoc::get_int_option(argc, argv, "--threads", aoc::default_thread_count());
 
   Input r;
   if (inTest) {
@@ -103,47 +441,68 @@ int main(int argc, char** argv) {
 
   {
     aoc::AutoTimer t{"Part 1"};
-
-    auto *p = r.start;
-    while (!p->is_end) {
-      const auto c = r.pattern.data()[part1 % r.pattern.size()];
-      part1++;
-      if (c == 'L') {
-        p = p->L;
-      } else if (c == 'R') {
-        p = p->R;
-      }
-    }
-  }
-
-  {
-    aoc::AutoTimer t{"Part 2"};
-    std::vector<int64_t> distances;
-    for (auto *p : r.sources) {
-      int64_t d = 0;
-      while (!p->is_terminal) {
-        const auto c = r.pattern.data()[d % r.pattern.size()];
-        d++;
-        if (c == 'L') {
-          p = p->L;
-        } else if (c == 'R') {
-          p = p->R;
-        }
-      }
-      distances.push_back(d);
+    if (r.has_start) {
+      const auto end = EncodeNode("ZZZ");
+      part1 = r.Walk(EncodeNode("AAA"), [end](NodeId p) { return p == end; });
     }
-    part2 = aoc::lcm(distances.begin(), distances.end());
   }
 
+  // the second example is for part 2
   if (inTest) {
     r = LoadInput(SampleInput2);
   }
 
+  {
+    aoc::AutoTimer t{"Part 2"};
+    part2 = SolveGhosts(r, threads);
+  }
+
   aoc::print_results(part1, part2);
 
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+    aoc::assert_result(SolveGhosts(LoadInput(SampleInput3), 2), SR_Part2_3);
+
+    // thirty ghosts with two hits each, all hitting at SR_Wide: far more candidate
+    // residues than could be enumerated, and a combined modulus well past int64
+    const auto wide = PrimeGhosts(30, [](size_t i, int64_t p) {
+      return std::vector<int64_t>{ SR_Wide % p, static_cast<int64_t>(SR_Wide * 7 + i) % p };
+    });
+    const auto t = AlignGhosts(wide);
+    const bool all_hit = std::all_of(wide.begin(), wide.end(), [t](const auto& g) { return g.HitAt(t); });
+    aoc::assert_result(all_hit && t <= SR_Wide, true);
+
+    // six ghosts with thirty hits each, all hitting at SR_Many: too many residues to
+    // combine them all, so the last few are checked step by step
+    const auto many = PrimeGhosts(6, [](size_t i, int64_t p) {
+      std::vector<int64_t> hits{ SR_Many % p };
+      for (int64_t k = 1; k < 30; k++) {
+        hits.push_back((SR_Many + k * k * 37 + static_cast<int64_t>(i)) % p);
+      }
+      return hits;
+    }, 1009);
+    const auto tm = AlignGhosts(many);
+    const bool many_hit = std::all_of(many.begin(), many.end(), [tm](const auto& g) { return g.HitAt(tm); });
+    aoc::assert_result(many_hit && tm <= SR_Many, true);
+
+    const auto align_error = [](const std::vector<GhostCycle>& ghosts) {
+      try {
+        AlignGhosts(ghosts);
+      } catch (const std::runtime_error& e) {
+        return std::string(e.what());
+      }
+      return std::string();
+    };
+    // one hit each, at residues whose only alignment is far beyond int64
+    aoc::assert_result(align_error(PrimeGhosts(30, [](size_t i, int64_t p) {
+      return std::vector<int64_t>{ static_cast<int64_t>(i) % p };
+    })), SR_WideError);
+    // even and odd steps only
+    std::vector<GhostCycle> parity(2);
+    parity[0] = { 0, 2, {}, { 0 } };
+    parity[1] = { 0, 2, {}, { 1 } };
+    aoc::assert_result(align_error(parity), SR_NeverError);
   }
 
   return 0;
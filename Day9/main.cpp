@@ -1,11 +1,13 @@
 #include "aoc/helpers.h"
+#include "aoc/cpu.h"
 
 #include <vector>
-#include <functional>
-#include <numeric>
-#include <ranges>
 #include <memory>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 namespace {
   using Result = std::pair<int, int>;
   using MappedFileSource = aoc::MappedFileSource<char>;
@@ -16,33 +18,188 @@ namespace {
   constexpr int SR_Part1 = 114;
   constexpr int SR_Part2 = 2;
 
-  using Sequence = std::vector<int64_t>;
-  using Sequences = std::vector<Sequence>;
+  using Wide = __int128;
+
+  // Binomial weights run out of 64 bits past this length
+  constexpr size_t MaxLength = 62;
+
+  // All the sequences of one length, a row each
+  struct SequenceBatch {
+    size_t count{0};
+    int64_t max_abs{0};
+    std::vector<int64_t> rows;
+  };
+
+  struct Sequences {
+    // indexed by length
+    std::vector<SequenceBatch> batches;
+  };
 
   const auto LoadInput = [](auto f) {
     Sequences s;
+    std::vector<int64_t> scratch;
     std::string_view line;
     while (aoc::getline(f, line)) {
-      s.emplace_back();
-      aoc::parse_as_integers(line, ' ', [&s](int64_t i) { s.back().push_back(i); });
+      scratch.clear();
+      int64_t v = 0;
+      int64_t sign = 1;
+      bool in_number = false;
+      for (const auto c : line) {
+        if (aoc::is_numeric(c)) {
+          v = v * 10 + (c - '0');
+          in_number = true;
+        } else if (c == '-') {
+          sign = -1;
+        } else if (in_number) {
+          scratch.push_back(sign * v);
+          v = 0;
+          sign = 1;
+          in_number = false;
+        }
+      }
+      if (in_number) {
+        scratch.push_back(sign * v);
+      }
+
+      if (scratch.size() > MaxLength) {
+        throw std::runtime_error("Sequence too long");
+      }
+      if (s.batches.size() <= scratch.size()) {
+        s.batches.resize(scratch.size() + 1);
+      }
+      auto& b = s.batches[scratch.size()];
+      b.rows.insert(b.rows.end(), scratch.begin(), scratch.end());
+      b.count++;
+      for (const auto x : scratch) {
+        b.max_abs = std::max(b.max_abs, std::abs(x));
+      }
     }
     return s;
   };
 
-  const auto Extrapolate = [](Sequence s, bool reverse) {
-    int64_t c{1};
-    int64_t v{0};
+  // Taking the n-th differences of n terms as zero, the next and previous terms are
+  //   x[n] = sum (-1)^(n-1-i) C(n, i) x[i]
+  //   x[-1] = sum (-1)^i C(n, i+1) x[i]
+  struct ExtrapolationWeights {
+    std::vector<int64_t> next;
+    std::vector<int64_t> prev;
 
-    if (reverse) {
-      std::reverse(s.begin(), s.end());
+    explicit ExtrapolationWeights(size_t n)
+      : next(n)
+      , prev(n)
+    {
+      std::vector<int64_t> binomial(n + 1, 0);
+      binomial[0] = 1;
+      for (size_t k = 1; k <= n; k++) {
+        binomial[k] = binomial[k - 1] * (n - k + 1) / k;
+      }
+      for (size_t i = 0; i < n; i++) {
+        next[i] = ((n - 1 - i) & 1 ? -1 : 1) * binomial[i];
+        prev[i] = (i & 1 ? -1 : 1) * binomial[i + 1];
+      }
     }
-    while (std::any_of(s.begin(), s.end() - c, std::identity{})) {
-      std::adjacent_difference(s.begin() + 1, s.end() - c + 1, s.begin());
-      v += *(s.end() - c);
-      ++c;
+  };
+
+  // Weighted sums down a column per term, for every sequence: next[k] and prev[k]
+  // gather w.next[i] * columns[i][k] and w.prev[i] * columns[i][k]
+  void SumColumnsScalar(const int64_t* columns, size_t count, size_t n, const ExtrapolationWeights& w,
+      size_t begin, int64_t* next, int64_t* prev) {
+    for (size_t i = 0; i < n; i++) {
+      const int64_t* col = columns + i * count;
+      const auto wn = w.next[i];
+      const auto wp = w.prev[i];
+      for (size_t k = begin; k < count; k++) {
+        next[k] += wn * col[k];
+        prev[k] += wp * col[k];
+      }
     }
+  }
 
-    return v;
+#if defined(__x86_64__)
+  // Four sequences per register.  AVX2 has no 64-bit multiply, but when the weights
+  // and terms all fit in 32 bits _mm256_mul_epi32 gives their exact 64-bit products.
+  __attribute__((target("avx2")))
+  void SumColumnsAVX2(const int64_t* columns, size_t count, size_t n, const ExtrapolationWeights& w,
+      int64_t* next, int64_t* prev) {
+    size_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+      __m256i acc_next = _mm256_setzero_si256();
+      __m256i acc_prev = _mm256_setzero_si256();
+      for (size_t i = 0; i < n; i++) {
+        const __m256i col = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns + i * count + k));
+        acc_next = _mm256_add_epi64(acc_next, _mm256_mul_epi32(_mm256_set1_epi64x(w.next[i]), col));
+        acc_prev = _mm256_add_epi64(acc_prev, _mm256_mul_epi32(_mm256_set1_epi64x(w.prev[i]), col));
+      }
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(next + k), acc_next);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(prev + k), acc_prev);
+    }
+    SumColumnsScalar(columns, count, n, w, k, next, prev);
+  }
+#endif
+
+  void SumColumns(const int64_t* columns, size_t count, size_t n, const ExtrapolationWeights& w,
+      int64_t max_abs, int64_t* next, int64_t* prev) {
+#if defined(__x86_64__)
+    // the largest weight is a central binomial coefficient, below 2^n
+    if (aoc::has_avx2() && max_abs <= INT32_MAX && n < 32) {
+      SumColumnsAVX2(columns, count, n, w, next, prev);
+      return;
+    }
+#endif
+    SumColumnsScalar(columns, count, n, w, 0, next, prev);
+  }
+
+  // Sum of the next and previous terms of every sequence in the batch.  When the
+  // weighted sums cannot leave 64 bits the batch is transposed to a column per term
+  // and summed across sequences, four at a time when the values are narrow enough;
+  // otherwise each sequence is summed in 128 bits.
+  std::pair<Wide, Wide> ExtrapolateBatch(size_t n, const SequenceBatch& b) {
+    const ExtrapolationWeights w(n);
+    Wide next_total = 0;
+    Wide prev_total = 0;
+
+    // the weights on either side sum to less than 2^n in magnitude
+    if (static_cast<Wide>(b.max_abs) << n < static_cast<Wide>(INT64_MAX)) {
+      std::vector<int64_t> columns(b.rows.size());
+      for (size_t k = 0; k < b.count; k++) {
+        for (size_t i = 0; i < n; i++) {
+          columns[i * b.count + k] = b.rows[k * n + i];
+        }
+      }
+      std::vector<int64_t> next(b.count, 0);
+      std::vector<int64_t> prev(b.count, 0);
+      SumColumns(columns.data(), b.count, n, w, b.max_abs, next.data(), prev.data());
+      for (size_t k = 0; k < b.count; k++) {
+        next_total += next[k];
+        prev_total += prev[k];
+      }
+    } else {
+      for (size_t k = 0; k < b.count; k++) {
+        for (size_t i = 0; i < n; i++) {
+          next_total += static_cast<Wide>(w.next[i]) * b.rows[k * n + i];
+          prev_total += static_cast<Wide>(w.prev[i]) * b.rows[k * n + i];
+        }
+      }
+    }
+    return { next_total, prev_total };
+  }
+
+  // Both parts in one pass over the batches
+  const auto Extrapolate = [](const Sequences& s) -> std::pair<int64_t, int64_t> {
+    Wide next = 0;
+    Wide prev = 0;
+    for (size_t n = 1; n < s.batches.size(); n++) {
+      if (!s.batches[n].count) {
+        continue;
+      }
+      const auto [bn, bp] = ExtrapolateBatch(n, s.batches[n]);
+      next += bn;
+      prev += bp;
+    }
+    if (next > INT64_MAX || next < INT64_MIN || prev > INT64_MAX || prev < INT64_MIN) {
+      throw std::runtime_error("Extrapolated sums overflow");
+    }
+    return { static_cast<int64_t>(next), static_cast<int64_t>(prev) };
   };
 }
 
@@ -59,18 +216,11 @@ int main(int argc, char** argv) {
     seq = LoadInput(f);
   }
 
-  auto fwd = [&](const auto& q){ return Extrapolate(q, false); };
-  auto rev = [&](const auto& q){ return Extrapolate(q, true); }; 
-
   int64_t part1 = 0;
-  {
-    aoc::AutoTimer t1{"Part 1"};
-    part1 = std::transform_reduce(seq.begin(), seq.end(), 0, std::plus<>(), fwd);
-  }
   int64_t part2 = 0;
   {
-    aoc::AutoTimer t2{"Part 2"};
-    part2 = std::transform_reduce(seq.begin(), seq.end(), 0, std::plus<>(), rev);
+    aoc::AutoTimer t1{"Parts 1 and 2"};
+    std::tie(part1, part2) = Extrapolate(seq);
   }
 
   aoc::print_results(part1, part2);
@@ -78,6 +228,24 @@ int main(int argc, char** argv) {
   if (inTest) {
     aoc::assert_result(part1, SR_Part1);
     aoc::assert_result(part2, SR_Part2);
+
+    // eleven cubics of one length, two whole vectors and three over, checked against
+    // evaluating the cubics either side of the sequence
+    constexpr int64_t Length = 21;
+    const auto cubic = [](int64_t k, int64_t j) { return (k - 5) * j * j * j + 3 * j - k * 1000; };
+    std::string text;
+    int64_t next = 0;
+    int64_t prev = 0;
+    for (int64_t k = 0; k < 11; k++) {
+      for (int64_t j = 0; j < Length; j++) {
+        text += std::to_string(cubic(k, j)) + (j + 1 < Length ? " " : "\n");
+      }
+      next += cubic(k, Length);
+      prev += cubic(k, -1);
+    }
+    const auto [cubic_next, cubic_prev] = Extrapolate(LoadInput(std::string_view(text)));
+    aoc::assert_result(cubic_next, next);
+    aoc::assert_result(cubic_prev, prev);
   }
 
   return 0;
@@ -0,0 +1,16 @@
+#pragma once
+
+namespace aoc {
+
+    // Whether kernels built with __attribute__((target("avx2"))) can run here; the
+    // answer is looked up once and kept
+    inline bool has_avx2() {
+#if defined(__x86_64__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+#else
+        return false;
+#endif
+    }
+
+} // namespace aoc
@@ -97,6 +97,26 @@ std::ostream& operator<<(std::ostream& os, const aoc::Point p) {
     return os;
 }
 
+std::ostream& operator<<(std::ostream& os, unsigned __int128 u) {
+    // peel off decimal digits
+    char buf[40];
+    char* p = buf + sizeof(buf);
+    do {
+        *--p = static_cast<char>('0' + static_cast<int>(u % 10));
+        u /= 10;
+    } while (u);
+    os.write(p, buf + sizeof(buf) - p);
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const __int128 v) {
+    if (v < 0) {
+        os << '-';
+    }
+    // the magnitude fits unsigned even for the minimum
+    return os << (v < 0 ? -static_cast<unsigned __int128>(v) : static_cast<unsigned __int128>(v));
+}
+
 std::ostream& operator<<(std::ostream& os, const aoc::CardinalDirection p) {
     switch (p) {
         case aoc::CardinalDirection::North: os << "North"; return os;
@@ -291,6 +311,19 @@ namespace aoc {
         std::cout << " OK" << std::endl;
     };
 
+    // assert_result over a whole batch, reporting the first result that differs
+    const auto assert_results = [](const auto& r, const auto& e) {
+        size_t i = 0;
+        while (i < std::size(r) && i < std::size(e) && r[i] == e[i]) {
+            i++;
+        }
+        if (i < std::size(r) && i < std::size(e)) {
+            std::cout << "Result " << i << ": ";
+            assert_result(r[i], e[i]);
+        }
+        assert_result(std::size(r), std::size(e));
+    };
+
     auto open_argv_1(int argc, char **argv) {
         if (argc < 2) {
             throw std::runtime_error("Insufficient arguments");
@@ -401,6 +434,16 @@ namespace aoc {
         return out * (1 - 2 * neg);
     }
 
+    // Look for `name value' amongst the arguments following the input file
+    int64_t get_int_option(int argc, char **argv, const std::string_view name, int64_t def) {
+        for (int i = 2; i + 1 < argc; i++) {
+            if (name == argv[i]) {
+                return aoc::stoi(argv[i + 1]);
+            }
+        }
+        return def;
+    }
+
     constexpr std::string_view eol_delims{"\r\n", 2};
 
     bool getline(std::string_view& s, std::string_view& out, const std::string_view delims, bool return_empty = false) {
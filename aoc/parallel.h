@@ -0,0 +1,38 @@
+#pragma once
+
+#include "aoc/helpers.h"
+#include <algorithm>
+#include <thread>
+
+namespace aoc {
+
+    inline size_t default_thread_count() {
+        const auto n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    // Split [0, n) into one contiguous chunk per thread and call fn(begin, end) for
+    // each; the calling thread takes the first chunk.
+    template<typename Fn>
+    void parallel_for(size_t n, size_t threads, Fn fn) {
+        threads = std::max<size_t>(1, std::min(threads, n));
+        if (threads == 1) {
+            fn(size_t{0}, n);
+            return;
+        }
+
+        const size_t chunk = (n + threads - 1) / threads;
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        for (size_t t = 1; t < threads; t++) {
+            const size_t begin = std::min(n, t * chunk);
+            const size_t end = std::min(n, begin + chunk);
+            workers.emplace_back([&fn, begin, end]() { fn(begin, end); });
+        }
+        fn(size_t{0}, std::min(n, chunk));
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+} // namespace aoc